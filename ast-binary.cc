@@ -0,0 +1,771 @@
+//////////////////////////////////////////////////////////////////////
+//
+// Writes and reads ASTs in the binary form described in ast-binary.h, so
+// that neither the checker nor a code generator has to parse the textual
+// dump.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ast-binary.h"
+#include "semant.h"
+
+AstWriter::AstWriter() : record(0), next_child(0), first_child(0)
+{
+  symbol_ids = new std::unordered_map<Symbol, uint32_t>();
+  symbol_offsets = new std::vector<uint32_t>();
+  symbols = new std::vector<uint32_t>();
+  node_offsets = new std::vector<uint32_t>();
+  nodes = new std::vector<uint32_t>();
+  results = new std::vector<uint32_t>();
+  classes = new std::vector<AstClass>();
+  methods = new std::vector<AstMethod>();
+  attrs = new std::vector<AstAttr>();
+  formals = new std::vector<AstFormal>();
+}
+
+AstWriter::~AstWriter()
+{
+  delete symbol_ids;
+  delete symbol_offsets;
+  delete symbols;
+  delete node_offsets;
+  delete nodes;
+  delete results;
+  delete classes;
+  delete methods;
+  delete attrs;
+  delete formals;
+}
+
+/* Offsets are kept relative to their section until the file is laid out */
+uint32_t AstWriter::symbol(Symbol sym, AstSymbolTable table)
+{
+  if (sym == NULL) {
+    return AST_NONE;
+  }
+  std::unordered_map<Symbol, uint32_t>::iterator it = symbol_ids->find(sym);
+  if (it != symbol_ids->end()) {
+    return it->second;
+  }
+
+  uint32_t id = symbol_offsets->size();
+  symbol_offsets->push_back(symbols->size() * sizeof(uint32_t));
+  symbols->push_back(table);
+  symbols->push_back(sym->get_len());
+  size_t start = symbols->size();
+  symbols->resize(start + (sym->get_len() + sizeof(uint32_t)) / sizeof(uint32_t), 0);
+  memcpy(&(*symbols)[start], sym->get_string(), sym->get_len());
+  symbol_ids->insert(std::make_pair(sym, id));
+  return id;
+}
+
+/* The node's children are the last children results, in get_children order */
+void AstWriter::begin(ExpressionKind kind, Expression expr, int children)
+{
+  assert((int) results->size() >= children);
+  first_child = next_child = results->size() - children;
+  node_offsets->push_back(nodes->size() * sizeof(uint32_t));
+  nodes->push_back(kind);
+  nodes->push_back(expr->get_line_number());
+  nodes->push_back(symbol(expr->get_type()));
+  nodes->push_back(0);
+  record = nodes->size();
+}
+
+void AstWriter::end()
+{
+  assert(next_child == results->size());
+  (*nodes)[record - 1] = nodes->size() - record;
+  results->resize(first_child);
+  results->push_back(node_offsets->size() - 1);
+}
+
+//////////////////////////////////////////////////////////////////////
+//
+// Node records, in the field order listed in ast-binary.h
+//
+//////////////////////////////////////////////////////////////////////
+
+/* Nodes with n children that carry no fields of their own */
+static void write_operands(AstWriter *writer, Expression expr, int n)
+{
+  writer->begin(expr->get_kind(), expr, n);
+  for (int i = 0; i < n; i++) {
+    writer->child();
+  }
+  writer->end();
+}
+
+static void write_dispatch(AstWriter *writer, Expression expr, Symbol type_name, Symbol name,
+			   std::vector<Expression> *actuals)
+{
+  writer->begin(expr->get_kind(), expr, 1 + actuals->size());
+  writer->child();
+  if (type_name != NULL) {
+    writer->field(writer->symbol(type_name));
+  }
+  writer->field(writer->symbol(name));
+  writer->field(actuals->size());
+  for (size_t i = 0; i < actuals->size(); i++) {
+    writer->child();
+  }
+  writer->end();
+}
+
+static void write_typcase(AstWriter *writer, typcase_class *expr)
+{
+  std::vector<Case> *cases = expr->get_case_list();
+  writer->begin(EXPR_TYPCASE, expr, 1 + cases->size());
+  writer->child();
+  writer->field(cases->size());
+  for (std::vector<Case>::iterator it = cases->begin(); it != cases->end(); it++) {
+    writer->field((*it)->get_line_number());
+    writer->field(writer->symbol((*it)->get_name()));
+    writer->field(writer->symbol((*it)->get_type_decl()));
+    writer->child();
+  }
+  writer->end();
+}
+
+static void write_block(AstWriter *writer, block_class *expr)
+{
+  std::vector<Expression> *body = expr->get_body_list();
+  writer->begin(EXPR_BLOCK, expr, body->size());
+  writer->field(body->size());
+  for (size_t i = 0; i < body->size(); i++) {
+    writer->child();
+  }
+  writer->end();
+}
+
+static void write_let(AstWriter *writer, let_class *expr)
+{
+  writer->begin(EXPR_LET, expr, 2);
+  writer->field(writer->symbol(expr->get_identifier()));
+  writer->field(writer->symbol(expr->get_type_decl()));
+  writer->child();
+  writer->child();
+  writer->end();
+}
+
+/* Nodes whose only field is one symbol */
+static void write_leaf(AstWriter *writer, Expression expr, Symbol sym, AstSymbolTable table = AST_ID_TABLE)
+{
+  writer->begin(expr->get_kind(), expr, 0);
+  writer->field(writer->symbol(sym, table));
+  writer->end();
+}
+
+/* Writes the record of a node whose children have just been written */
+static void write_record(AstWriter *writer, Expression expr)
+{
+  switch (expr->get_kind()) {
+  case EXPR_ASSIGN:
+    writer->begin(EXPR_ASSIGN, expr, 1);
+    writer->field(writer->symbol(static_cast<assign_class *>(expr)->get_name()));
+    writer->child();
+    writer->end();
+    return;
+  case EXPR_STATIC_DISPATCH: {
+    static_dispatch_class *dispatch = static_cast<static_dispatch_class *>(expr);
+    write_dispatch(writer, expr, dispatch->get_type_name(), dispatch->get_name(), dispatch->get_actual_list());
+    return;
+  }
+  case EXPR_DISPATCH: {
+    dispatch_class *dispatch = static_cast<dispatch_class *>(expr);
+    write_dispatch(writer, expr, NULL, dispatch->get_name(), dispatch->get_actual_list());
+    return;
+  }
+  case EXPR_COND:
+    write_operands(writer, expr, 3);
+    return;
+  case EXPR_LOOP:
+  case EXPR_PLUS:
+  case EXPR_SUB:
+  case EXPR_MUL:
+  case EXPR_DIVIDE:
+  case EXPR_LT:
+  case EXPR_EQ:
+  case EXPR_LEQ:
+    write_operands(writer, expr, 2);
+    return;
+  case EXPR_NEG:
+  case EXPR_COMP:
+  case EXPR_ISVOID:
+    write_operands(writer, expr, 1);
+    return;
+  case EXPR_NO_EXPR:
+    write_operands(writer, expr, 0);
+    return;
+  case EXPR_TYPCASE:
+    write_typcase(writer, static_cast<typcase_class *>(expr));
+    return;
+  case EXPR_BLOCK:
+    write_block(writer, static_cast<block_class *>(expr));
+    return;
+  case EXPR_LET:
+    write_let(writer, static_cast<let_class *>(expr));
+    return;
+  case EXPR_INT_CONST:
+    write_leaf(writer, expr, static_cast<int_const_class *>(expr)->get_token(), AST_INT_TABLE);
+    return;
+  case EXPR_BOOL_CONST:
+    writer->begin(EXPR_BOOL_CONST, expr, 0);
+    writer->field(static_cast<bool_const_class *>(expr)->get_val());
+    writer->end();
+    return;
+  case EXPR_STRING_CONST:
+    write_leaf(writer, expr, static_cast<string_const_class *>(expr)->get_token(), AST_STRING_TABLE);
+    return;
+  case EXPR_NEW:
+    write_leaf(writer, expr, static_cast<new__class *>(expr)->get_type_name());
+    return;
+  case EXPR_OBJECT:
+    write_leaf(writer, expr, static_cast<object_class *>(expr)->get_name());
+    return;
+  }
+  assert(0 && "unknown expression kind");
+}
+
+/*
+ * Writes an expression tree children first, without recursion, and returns
+ * the index of its root.  A node is pushed twice: the first time it is
+ * popped its children go on the stack, the second time it writes itself.
+ */
+uint32_t AstWriter::expression(Expression root)
+{
+  std::vector<std::pair<Expression, bool> > stack;
+  std::vector<Expression> children;
+
+  stack.push_back(std::make_pair(root, false));
+  while (!stack.empty()) {
+    std::pair<Expression, bool> top = stack.back();
+    stack.pop_back();
+    if (top.second) {
+      write_record(this, top.first);
+      continue;
+    }
+    stack.push_back(std::make_pair(top.first, true));
+    children.clear();
+    top.first->get_children(children);
+    for (std::vector<Expression>::reverse_iterator it = children.rbegin(); it != children.rend(); it++) {
+      stack.push_back(std::make_pair(*it, false));
+    }
+  }
+
+  uint32_t index = results->back();
+  results->pop_back();
+  return index;
+}
+
+void AstWriter::add_class(Class_ class_)
+{
+  uint32_t class_id = classes->size();
+  AstClass entry = {
+    symbol(class_->get_name()), symbol(class_->get_parent()),
+    symbol(class_->get_filename(), AST_STRING_TABLE), (uint32_t) class_->get_line_number(),
+    (uint32_t) methods->size(), 0, (uint32_t) attrs->size(), 0
+  };
+
+  std::vector<Feature> *features = class_->get_feature_list();
+  for (std::vector<Feature>::iterator it = features->begin(); it != features->end(); it++) {
+    Feature feature = *it;
+    uint32_t position = it - features->begin();
+    if (feature->is_method()) {
+      AstMethod method = {
+	class_id, symbol(feature->get_name()), symbol(feature->get_return_type()),
+	(uint32_t) feature->get_line_number(), (uint32_t) formals->size(), 0, AST_NONE, position
+      };
+      std::vector<Formal> *formal_list = feature->get_formal_list();
+      for (std::vector<Formal>::iterator itt = formal_list->begin(); itt != formal_list->end(); itt++) {
+	AstFormal formal = {
+	  symbol((*itt)->get_name()), symbol((*itt)->get_type_decl()), (uint32_t) (*itt)->get_line_number()
+	};
+	formals->push_back(formal);
+	method.formal_count++;
+      }
+      method.body = expression(feature->get_expr());
+      methods->push_back(method);
+      entry.method_count++;
+    } else {
+      AstAttr attr = {
+	class_id, symbol(feature->get_name()), symbol(feature->get_type_decl()),
+	(uint32_t) feature->get_line_number(), expression(feature->get_expr()), position
+      };
+      attrs->push_back(attr);
+      entry.attr_count++;
+    }
+  }
+  classes->push_back(entry);
+}
+
+static void write_bytes(ostream& stream, const void *data, size_t bytes)
+{
+  stream.write((const char *) data, bytes);
+}
+
+/* Section offsets become absolute on the way out */
+static void write_offsets(ostream& stream, std::vector<uint32_t> *offsets, uint32_t base)
+{
+  for (std::vector<uint32_t>::iterator it = offsets->begin(); it != offsets->end(); it++) {
+    uint32_t offset = *it + base;
+    write_bytes(stream, &offset, sizeof(offset));
+  }
+}
+
+int AstWriter::write(ostream& stream)
+{
+  AstHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, AST_MAGIC, sizeof(header.magic));
+  header.version = AST_VERSION;
+
+  uint32_t offset = sizeof(header);
+  header.symbol_count = symbol_offsets->size();
+  header.symbol_offset = offset;
+  offset += symbol_offsets->size() * sizeof(uint32_t);
+  uint32_t symbols_start = offset;
+  offset += symbols->size() * sizeof(uint32_t);
+  header.node_count = node_offsets->size();
+  header.node_offset = offset;
+  offset += node_offsets->size() * sizeof(uint32_t);
+  uint32_t nodes_start = offset;
+  offset += nodes->size() * sizeof(uint32_t);
+  header.class_count = classes->size();
+  header.class_offset = offset;
+  offset += classes->size() * sizeof(AstClass);
+  header.method_count = methods->size();
+  header.method_offset = offset;
+  offset += methods->size() * sizeof(AstMethod);
+  header.attr_count = attrs->size();
+  header.attr_offset = offset;
+  offset += attrs->size() * sizeof(AstAttr);
+  header.formal_count = formals->size();
+  header.formal_offset = offset;
+  offset += formals->size() * sizeof(AstFormal);
+  header.size = offset;
+
+  write_bytes(stream, &header, sizeof(header));
+  write_offsets(stream, symbol_offsets, symbols_start);
+  write_bytes(stream, symbols->data(), symbols->size() * sizeof(uint32_t));
+  write_offsets(stream, node_offsets, nodes_start);
+  write_bytes(stream, nodes->data(), nodes->size() * sizeof(uint32_t));
+  write_bytes(stream, classes->data(), classes->size() * sizeof(AstClass));
+  write_bytes(stream, methods->data(), methods->size() * sizeof(AstMethod));
+  write_bytes(stream, attrs->data(), attrs->size() * sizeof(AstAttr));
+  write_bytes(stream, formals->data(), formals->size() * sizeof(AstFormal));
+  return stream ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int dump_binary(Program program, ostream& stream)
+{
+  AstWriter writer;
+  std::vector<Class_> *classes = program->get_class_list();
+  for (std::vector<Class_>::iterator it = classes->begin(); it != classes->end(); it++) {
+    writer.add_class(*it);
+  }
+  return writer.write(stream);
+}
+
+//////////////////////////////////////////////////////////////////////
+//
+// Loading
+//
+//////////////////////////////////////////////////////////////////////
+
+/* Lists are built balanced, so walking one never recurses more than log n deep */
+template <class Elem> static list_node<Elem> *make_list(Arena *arena, Elem *elems, int n)
+{
+  if (n == 0) {
+    return arena->make<nil_node<Elem> >();
+  }
+  if (n == 1) {
+    return arena->make<single_list_node<Elem> >(elems[0]);
+  }
+  int half = n / 2;
+  return arena->make<append_node<Elem> >(make_list(arena, elems, half), make_list(arena, elems + half, n - half));
+}
+
+// Builds a program from a mapped file.  The sections are checked against
+// the file once, up front, and every index into them before it is used; the
+// first bad one marks the file malformed and makes read() return NULL.
+
+class AstReader {
+private:
+  const char *base;
+  size_t size;
+  const AstHeader *header;
+  Arena *arena;
+  const uint32_t *node_offsets;
+  const AstClass *classes;
+  const AstMethod *methods;
+  const AstAttr *attrs;
+  const AstFormal *formals;
+  std::vector<Symbol> symbols;
+  std::vector<Expression> nodes;
+  std::vector<bool> claimed;
+  const uint32_t *fields;
+  uint32_t field_count;
+  uint32_t next_field;
+  bool bad;
+  const void *section(size_t offset, size_t count, size_t entry_size);
+  const uint32_t *words(size_t offset, size_t count);
+  void intern_symbols();
+  Symbol symbol(uint32_t id);
+  Symbol required_symbol(uint32_t id);
+  Expression node(uint32_t id);
+  uint32_t field();
+  Expressions expressions(uint32_t count);
+  Expression read_node(uint32_t id);
+  Class_ read_class(uint32_t id);
+
+public:
+  AstReader(const char *base, size_t size, Arena *arena) :
+    base(base), size(size), header(NULL), arena(arena), node_offsets(NULL), classes(NULL), methods(NULL),
+    attrs(NULL), formals(NULL), fields(NULL), field_count(0), next_field(0), bad(false) { }
+  Program read();
+};
+
+/* count entries of entry_size bytes at offset, or NULL if they are not all inside the file */
+const void *AstReader::section(size_t offset, size_t count, size_t entry_size)
+{
+  if (offset % sizeof(uint32_t) != 0 || offset > size || count > (size - offset) / entry_size) {
+    bad = true;
+    return NULL;
+  }
+  return base + offset;
+}
+
+const uint32_t *AstReader::words(size_t offset, size_t count)
+{
+  return (const uint32_t *) section(offset, count, sizeof(uint32_t));
+}
+
+/* Each symbol is interned once, whatever the number of nodes naming it */
+void AstReader::intern_symbols()
+{
+  const uint32_t *offsets = words(header->symbol_offset, header->symbol_count);
+  for (uint32_t id = 0; id < header->symbol_count && !bad; id++) {
+    const uint32_t *entry = words(offsets[id], 2);
+    if (entry == NULL || words((size_t) offsets[id] + 2 * sizeof(uint32_t), (entry[1] + sizeof(uint32_t)) / sizeof(uint32_t)) == NULL) {
+      return;
+    }
+    char *text = (char *) (entry + 2);
+    if (text[entry[1]] != '\0') {
+      bad = true;
+      return;
+    }
+    switch (entry[0]) {
+    case AST_ID_TABLE:
+      symbols.push_back(idtable.add_string(text, entry[1]));
+      break;
+    case AST_STRING_TABLE:
+      symbols.push_back(stringtable.add_string(text, entry[1]));
+      break;
+    case AST_INT_TABLE:
+      symbols.push_back(inttable.add_string(text, entry[1]));
+      break;
+    default:
+      bad = true;
+    }
+  }
+}
+
+Symbol AstReader::symbol(uint32_t id)
+{
+  if (id == AST_NONE) {
+    return NULL;
+  }
+  if (id >= symbols.size()) {
+    bad = true;
+    return NULL;
+  }
+  return symbols[id];
+}
+
+/* For every symbol but a node's type and Object's parent */
+Symbol AstReader::required_symbol(uint32_t id)
+{
+  if (id == AST_NONE) {
+    bad = true;
+    return NULL;
+  }
+  return symbol(id);
+}
+
+/*
+ * Children come before their parents, so a child is always built already.
+ * Every node has one parent, or is one method body or attribute initializer,
+ * so a node named twice marks the file malformed.
+ */
+Expression AstReader::node(uint32_t id)
+{
+  if (id >= nodes.size() || claimed[id]) {
+    bad = true;
+    return arena->make<no_expr_class>();
+  }
+  claimed[id] = true;
+  return nodes[id];
+}
+
+uint32_t AstReader::field()
+{
+  if (next_field == field_count) {
+    bad = true;
+    return AST_NONE;
+  }
+  return fields[next_field++];
+}
+
+Expressions AstReader::expressions(uint32_t count)
+{
+  std::vector<Expression> elems;
+  for (uint32_t i = 0; i < count && !bad; i++) {
+    elems.push_back(node(field()));
+  }
+  return make_list(arena, elems.data(), elems.size());
+}
+
+Expression AstReader::read_node(uint32_t id)
+{
+  const uint32_t *record = words(node_offsets[id], 4);
+  if (record == NULL || (fields = words((size_t) node_offsets[id] + 4 * sizeof(uint32_t), record[3])) == NULL) {
+    return NULL;
+  }
+  field_count = record[3];
+  next_field = 0;
+  node_lineno = record[1];
+
+  Expression expr = NULL;
+  Expression e1, e2, e3;
+  Symbol s1, s2;
+  switch (record[0]) {
+  case EXPR_ASSIGN:
+    s1 = required_symbol(field());
+    expr = arena->make<assign_class>(s1, node(field()));
+    break;
+  case EXPR_STATIC_DISPATCH:
+    e1 = node(field());
+    s1 = required_symbol(field());
+    s2 = required_symbol(field());
+    expr = arena->make<static_dispatch_class>(e1, s1, s2, expressions(field()));
+    break;
+  case EXPR_DISPATCH:
+    e1 = node(field());
+    s1 = required_symbol(field());
+    expr = arena->make<dispatch_class>(e1, s1, expressions(field()));
+    break;
+  case EXPR_COND:
+    e1 = node(field());
+    e2 = node(field());
+    e3 = node(field());
+    expr = arena->make<cond_class>(e1, e2, e3);
+    break;
+  case EXPR_LOOP:
+    e1 = node(field());
+    expr = arena->make<loop_class>(e1, node(field()));
+    break;
+  case EXPR_TYPCASE: {
+    e1 = node(field());
+    uint32_t count = field();
+    std::vector<Case> cases;
+    for (uint32_t i = 0; i < count && !bad; i++) {
+      node_lineno = field();
+      s1 = required_symbol(field());
+      s2 = required_symbol(field());
+      cases.push_back(arena->make<branch_class>(s1, s2, node(field())));
+    }
+    node_lineno = record[1];
+    expr = arena->make<typcase_class>(e1, make_list(arena, cases.data(), cases.size()));
+    break;
+  }
+  case EXPR_BLOCK:
+    expr = arena->make<block_class>(expressions(field()));
+    break;
+  case EXPR_LET:
+    s1 = required_symbol(field());
+    s2 = required_symbol(field());
+    e1 = node(field());
+    expr = arena->make<let_class>(s1, s2, e1, node(field()));
+    break;
+  case EXPR_PLUS:
+    e1 = node(field());
+    expr = arena->make<plus_class>(e1, node(field()));
+    break;
+  case EXPR_SUB:
+    e1 = node(field());
+    expr = arena->make<sub_class>(e1, node(field()));
+    break;
+  case EXPR_MUL:
+    e1 = node(field());
+    expr = arena->make<mul_class>(e1, node(field()));
+    break;
+  case EXPR_DIVIDE:
+    e1 = node(field());
+    expr = arena->make<divide_class>(e1, node(field()));
+    break;
+  case EXPR_NEG:
+    expr = arena->make<neg_class>(node(field()));
+    break;
+  case EXPR_LT:
+    e1 = node(field());
+    expr = arena->make<lt_class>(e1, node(field()));
+    break;
+  case EXPR_EQ:
+    e1 = node(field());
+    expr = arena->make<eq_class>(e1, node(field()));
+    break;
+  case EXPR_LEQ:
+    e1 = node(field());
+    expr = arena->make<leq_class>(e1, node(field()));
+    break;
+  case EXPR_COMP:
+    expr = arena->make<comp_class>(node(field()));
+    break;
+  case EXPR_INT_CONST:
+    expr = arena->make<int_const_class>(required_symbol(field()));
+    break;
+  case EXPR_BOOL_CONST:
+    expr = arena->make<bool_const_class>((Boolean) field());
+    break;
+  case EXPR_STRING_CONST:
+    expr = arena->make<string_const_class>(required_symbol(field()));
+    break;
+  case EXPR_NEW:
+    expr = arena->make<new__class>(required_symbol(field()));
+    break;
+  case EXPR_ISVOID:
+    expr = arena->make<isvoid_class>(node(field()));
+    break;
+  case EXPR_NO_EXPR:
+    expr = arena->make<no_expr_class>();
+    break;
+  case EXPR_OBJECT:
+    expr = arena->make<object_class>(required_symbol(field()));
+    break;
+  default:
+    bad = true;
+    return NULL;
+  }
+  if (next_field != field_count) {
+    bad = true;
+  }
+  if (record[2] != AST_NONE) {
+    expr->set_type(symbol(record[2]));
+  }
+  return expr;
+}
+
+Class_ AstReader::read_class(uint32_t id)
+{
+  const AstClass *entry = &classes[id];
+  if (entry->method_start > header->method_count || entry->method_count > header->method_count - entry->method_start ||
+      entry->attr_start > header->attr_count || entry->attr_count > header->attr_count - entry->attr_start) {
+    bad = true;
+    return NULL;
+  }
+
+  /* Methods and attributes go back to their places among the class's features */
+  std::vector<Feature> features(entry->method_count + entry->attr_count, NULL);
+  for (uint32_t i = entry->method_start; i < entry->method_start + entry->method_count && !bad; i++) {
+    const AstMethod &method = methods[i];
+    if (method.position >= features.size() || features[method.position] != NULL ||
+	method.formal_start > header->formal_count || method.formal_count > header->formal_count - method.formal_start) {
+      bad = true;
+      return NULL;
+    }
+    node_lineno = method.line;
+    std::vector<Formal> formal_list;
+    for (uint32_t k = method.formal_start; k < method.formal_start + method.formal_count; k++) {
+      node_lineno = formals[k].line;
+      formal_list.push_back(arena->make<formal_class>(required_symbol(formals[k].name), required_symbol(formals[k].type_decl)));
+    }
+    node_lineno = method.line;
+    Formals formal_nodes = make_list(arena, formal_list.data(), formal_list.size());
+    features[method.position] = arena->make<method_class>(required_symbol(method.name), formal_nodes,
+							   required_symbol(method.return_type), node(method.body));
+  }
+  for (uint32_t i = entry->attr_start; i < entry->attr_start + entry->attr_count && !bad; i++) {
+    const AstAttr &attr = attrs[i];
+    if (attr.position >= features.size() || features[attr.position] != NULL) {
+      bad = true;
+      return NULL;
+    }
+    node_lineno = attr.line;
+    features[attr.position] = arena->make<attr_class>(required_symbol(attr.name), required_symbol(attr.type_decl), node(attr.init));
+  }
+
+  Symbol name = required_symbol(entry->name);
+  Symbol parent = name != NULL && strcmp(name->get_string(), "Object") == 0 ?
+    symbol(entry->parent) : required_symbol(entry->parent);
+  Symbol filename = required_symbol(entry->filename);
+  if (bad) {
+    return NULL;
+  }
+
+  node_lineno = entry->line;
+  return arena->make<class__class>(name, parent, make_list(arena, features.data(), features.size()), filename);
+}
+
+Program AstReader::read()
+{
+  header = (const AstHeader *) words(0, sizeof(AstHeader) / sizeof(uint32_t));
+  if (header == NULL || memcmp(header->magic, AST_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != AST_VERSION || header->size != size) {
+    return NULL;
+  }
+  node_offsets = words(header->node_offset, header->node_count);
+  classes = (const AstClass *) section(header->class_offset, header->class_count, sizeof(AstClass));
+  methods = (const AstMethod *) section(header->method_offset, header->method_count, sizeof(AstMethod));
+  attrs = (const AstAttr *) section(header->attr_offset, header->attr_count, sizeof(AstAttr));
+  formals = (const AstFormal *) section(header->formal_offset, header->formal_count, sizeof(AstFormal));
+  if (bad) {
+    return NULL;
+  }
+
+  intern_symbols();
+  nodes.reserve(header->node_count);
+  claimed.assign(header->node_count, false);
+  for (uint32_t id = 0; id < header->node_count && !bad; id++) {
+    nodes.push_back(read_node(id));
+  }
+  std::vector<Class_> class_nodes;
+  for (uint32_t id = 0; id < header->class_count && !bad; id++) {
+    class_nodes.push_back(read_class(id));
+  }
+  if (bad) {
+    return NULL;
+  }
+  return arena->make<program_class>(make_list(arena, class_nodes.data(), class_nodes.size()));
+}
+
+Program read_binary_ast(const char *path, Arena *arena)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  void *base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return NULL;
+  }
+
+  /* The nodes keep no pointers into the file, so the mapping can go */
+  AstReader reader((const char *) base, info.st_size, arena);
+  Program program = reader.read();
+  munmap(base, info.st_size);
+  return program;
+}
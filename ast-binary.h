@@ -0,0 +1,177 @@
+#ifndef AST_BINARY_H_
+#define AST_BINARY_H_
+
+// Binary form of a typed AST, laid out so that a code generator can map
+// the file and use it in place.  Every field is a 32-bit word in host byte
+// order, offsets are in bytes from the start of the file, and AST_NONE
+// stands for a missing symbol or node.
+//
+//    AstHeader
+//    symbol offsets   symbol_count words
+//    symbols          AstSymbol, then its text, NUL-padded to a word
+//    node offsets     node_count words
+//    nodes            AstNode, then field_count words
+//    classes          class_count AstClass
+//    methods          method_count AstMethod
+//    attributes       attr_count AstAttr
+//    formals          formal_count AstFormal
+//
+// Symbols are numbered in order of first use and remember the table they
+// were interned in.  Nodes are the expressions, numbered children first, so
+// every child has a smaller index than its parent, and each node is named
+// once, by its parent or as a method body or attribute initializer; kind is
+// the ExpressionKind and type the symbol of the type semant gave the node.
+// Their fields, by kind:
+//
+//    assign             name, expr
+//    static_dispatch    expr, type_name, name, n, n actuals
+//    dispatch           expr, name, n, n actuals
+//    cond               pred, then, else
+//    loop               pred, body
+//    typcase            expr, n, n times (line, name, type_decl, expr)
+//    block              n, n expressions
+//    let                identifier, type_decl, init, body
+//    plus .. leq        e1, e2
+//    neg, comp, isvoid  e1
+//    int_const          token (an int symbol)
+//    bool_const         value
+//    string_const       token (a string symbol)
+//    new                type_name
+//    no_expr            no fields
+//    object             name
+//
+// A class's methods and attributes are consecutive entries of the method
+// and attribute indexes, in declaration order, and likewise a method's
+// formals; position is a feature's place among all of its class's features.
+//
+// read_binary_ast loads such a file in place of parsing the textual AST.
+
+#include <stdint.h>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include "cool-tree.h"
+
+#define AST_MAGIC "COOLTAST"
+#define AST_VERSION 2
+#define AST_NONE 0xffffffffu
+
+enum AstSymbolTable {
+  AST_ID_TABLE,
+  AST_STRING_TABLE,
+  AST_INT_TABLE
+};
+
+struct AstHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t symbol_count;
+  uint32_t symbol_offset;
+  uint32_t node_count;
+  uint32_t node_offset;
+  uint32_t class_count;
+  uint32_t class_offset;
+  uint32_t method_count;
+  uint32_t method_offset;
+  uint32_t attr_count;
+  uint32_t attr_offset;
+  uint32_t formal_count;
+  uint32_t formal_offset;
+  uint32_t size;
+};
+
+struct AstSymbol {
+  uint32_t table;
+  uint32_t length;
+};
+
+struct AstNode {
+  uint32_t kind;
+  uint32_t line;
+  uint32_t type;
+  uint32_t field_count;
+};
+
+struct AstClass {
+  uint32_t name;
+  uint32_t parent;
+  uint32_t filename;
+  uint32_t line;
+  uint32_t method_start;
+  uint32_t method_count;
+  uint32_t attr_start;
+  uint32_t attr_count;
+};
+
+struct AstMethod {
+  uint32_t class_id;
+  uint32_t name;
+  uint32_t return_type;
+  uint32_t line;
+  uint32_t formal_start;
+  uint32_t formal_count;
+  uint32_t body;
+  uint32_t position;
+};
+
+struct AstAttr {
+  uint32_t class_id;
+  uint32_t name;
+  uint32_t type_decl;
+  uint32_t line;
+  uint32_t init;
+  uint32_t position;
+};
+
+struct AstFormal {
+  uint32_t name;
+  uint32_t type_decl;
+  uint32_t line;
+};
+
+// Builds the sections in memory, then writes them out in one go.  An
+// expression tree is walked without recursion; once a node's children are
+// written, its record is written through begin/field/child/end.
+
+class AstWriter {
+private:
+  std::unordered_map<Symbol, uint32_t> *symbol_ids;
+  std::vector<uint32_t> *symbol_offsets;
+  std::vector<uint32_t> *symbols;
+  std::vector<uint32_t> *node_offsets;
+  std::vector<uint32_t> *nodes;
+  std::vector<uint32_t> *results;
+  size_t record;
+  size_t next_child;
+  size_t first_child;
+  std::vector<AstClass> *classes;
+  std::vector<AstMethod> *methods;
+  std::vector<AstAttr> *attrs;
+  std::vector<AstFormal> *formals;
+  AstWriter(const AstWriter &);
+  AstWriter &operator=(const AstWriter &);
+
+public:
+  AstWriter();
+  ~AstWriter();
+  uint32_t symbol(Symbol sym, AstSymbolTable table = AST_ID_TABLE);
+  uint32_t expression(Expression root);
+  void add_class(Class_ class_);
+  int write(ostream& stream);
+
+  /* Used by the node record writers in ast-binary.cc */
+  void begin(ExpressionKind kind, Expression expr, int children);
+  void field(uint32_t word) { nodes->push_back(word); }
+  void child() { nodes->push_back((*results)[next_child++]); }
+  void end();
+};
+
+// Writes a checked program in this format.
+int dump_binary(Program program, ostream& stream);
+
+// Reads a file in this format, building every node in arena and interning
+// each symbol once; types found in the file are kept.  Returns NULL if the
+// file cannot be read or is malformed.
+Program read_binary_ast(const char *path, Arena *arena);
+
+#endif
@@ -8,13 +8,25 @@
 //
 //////////////////////////////////////////////////////////
 
-#include <list>
 #include <map>
+#include <unordered_map>
+#include <vector>
 #include <symtab.h>
 
 #include "tree.h"
 #include "cool-tree.handcode.h"
 
+class Arena;
+template <class T> class ArenaAllocator;
+class MethodSignature;
+class ScopedEnv;
+class SemantContext;
+typedef SemantContext *SemantContextP;
+class SemantResult;
+typedef class Class__class *Class_;
+typedef class Expression_class *Expression;
+typedef std::map<Symbol, Feature, std::less<Symbol>, ArenaAllocator<std::pair<const Symbol, Feature> > > MethodTable;
+
 
 // define the class for phylum
 // define simple phylum - Program
@@ -24,6 +36,8 @@ class Program_class : public tree_node {
 public:
    tree_node *copy()		 { return copy_Program(); }
    virtual Program copy_Program() = 0;
+   virtual SemantResult *check() = 0;
+   virtual std::vector<Class_> *get_class_list() = 0;
 
 #ifdef Program_EXTRAS
    Program_EXTRAS
@@ -38,16 +52,16 @@ class Class__class : public tree_node {
 public:
    virtual Symbol get_name() = 0;
    virtual Symbol get_parent() = 0;
-   virtual bool get_marked() = 0;
-   virtual Symbol get_attr(Symbol var) = 0;
-   virtual Feature get_method(Symbol method_name) = 0;
-   virtual int get_environment() = 0;
-   virtual void add_child(Class_ class_) = 0;
-   virtual int check_cycle() = 0;
-   virtual int check_attrs() = 0;
-   virtual void semant() = 0;
-   virtual std::map<Symbol, Feature> * get_method_table() = 0;
-   virtual SymbolTable<Symbol, Symbol> * get_object_table() = 0;
+   virtual int get_environment(SemantContextP ctx) = 0;
+   virtual int check_attrs(SemantContextP ctx) = 0;
+   virtual void semant(SemantContextP ctx) = 0;
+   virtual int get_weight() = 0;
+   virtual void install_tables(Arena *arena) = 0;
+   virtual void release_tables() = 0;
+   virtual size_t release_scratch() = 0;
+   virtual MethodTable * get_method_table() = 0;
+   virtual ScopedEnv * get_object_table() = 0;
+   virtual std::vector<Feature> * get_feature_list() = 0;
 
    tree_node *copy()		 { return copy_Class_(); }
    virtual Class_ copy_Class_() = 0;
@@ -63,14 +77,20 @@ typedef class Feature_class *Feature;
 
 class Feature_class : public tree_node {
 public:
-   virtual int check_attrs() = 0;
-   virtual int get_environment() = 0;
+   virtual int check_attrs(SemantContextP ctx) = 0;
+   virtual int get_environment(SemantContextP ctx) = 0;
    virtual Symbol get_name() = 0;
+   virtual bool is_method() = 0;
    virtual Symbol get_return_type() = 0;
+   virtual Symbol get_type_decl() = 0;
    virtual Symbol get_arg_type(int i) = 0;
    virtual int get_arg_len() = 0;
+   virtual MethodSignature *get_signature() = 0;
+   virtual void release_signature() = 0;
    virtual Formals get_formals() = 0;
-   virtual void semant() = 0;
+   virtual std::vector<Formal> *get_formal_list() = 0;
+   virtual Expression get_expr() = 0;
+   virtual void semant(SemantContextP ctx) = 0;
 
    tree_node *copy()		 { return copy_Feature(); }
    virtual Feature copy_Feature() = 0;
@@ -87,7 +107,7 @@ typedef class Formal_class *Formal;
 class Formal_class : public tree_node {
 public:
    tree_node *copy()		 { return copy_Formal(); }
-   virtual void semant() = 0;
+   virtual void semant(SemantContextP ctx) = 0;
    virtual Symbol get_name() = 0;
    virtual Symbol get_type_decl() = 0;
    virtual Formal copy_Formal() = 0;
@@ -101,11 +121,45 @@ public:
 // define simple phylum - Expression
 typedef class Expression_class *Expression;
 
+// Which subclass an expression node is, so the checker can dispatch on
+// it with a switch instead of a virtual call.
+enum ExpressionKind {
+   EXPR_ASSIGN,
+   EXPR_STATIC_DISPATCH,
+   EXPR_DISPATCH,
+   EXPR_COND,
+   EXPR_LOOP,
+   EXPR_TYPCASE,
+   EXPR_BLOCK,
+   EXPR_LET,
+   EXPR_PLUS,
+   EXPR_SUB,
+   EXPR_MUL,
+   EXPR_DIVIDE,
+   EXPR_NEG,
+   EXPR_LT,
+   EXPR_EQ,
+   EXPR_LEQ,
+   EXPR_COMP,
+   EXPR_INT_CONST,
+   EXPR_BOOL_CONST,
+   EXPR_STRING_CONST,
+   EXPR_NEW,
+   EXPR_ISVOID,
+   EXPR_NO_EXPR,
+   EXPR_OBJECT
+};
+
 class Expression_class : public tree_node {
+protected:
+   ExpressionKind kind;
 public:
    tree_node *copy()		 { return copy_Expression(); }
    virtual Expression copy_Expression() = 0;
-   virtual void semant() = 0;
+   ExpressionKind get_kind() { return kind; }
+   void semant(SemantContextP ctx);
+   virtual Expression semant_step(SemantContextP ctx, int &state) = 0;
+   virtual void get_children(std::vector<Expression> &children) = 0;
 
 #ifdef Expression_EXTRAS
    Expression_EXTRAS
@@ -120,7 +174,9 @@ class Case_class : public tree_node {
 public:
    tree_node *copy()		 { return copy_Case(); }
    virtual Case copy_Case() = 0;
-   virtual void semant() = 0;
+   virtual void enter_scope(SemantContextP ctx) = 0;
+   virtual void exit_scope(SemantContextP ctx) = 0;
+   virtual Symbol get_name() = 0;
    virtual Expression get_expr() = 0;
    virtual Symbol get_type_decl() = 0;
 
@@ -156,16 +212,34 @@ typedef list_node<Case> Cases_class;
 typedef Cases_class *Cases;
 
 
+// Contiguous copy of a list, taken once when the node owning it is built so
+// that every later pass indexes it in O(1).
+template <class Elem> void flatten_list(list_node<Elem> *list, std::vector<Elem> &elems)
+{
+  elems.clear();
+  elems.reserve(list->len());
+  for (int i = list->first(); list->more(i); i = list->next(i)) {
+    elems.push_back(list->nth(i));
+  }
+}
+
+
 // define the class for constructors
 // define constructor - program
 class program_class : public Program_class {
 protected:
    Classes classes;
+   std::vector<Class_> class_list;
 public:
    program_class(Classes a1) {
       classes = a1;
+      flatten_list(classes, class_list);
+   }
+   std::vector<Class_> *get_class_list() {
+     return &class_list;
    }
    Program copy_Program();
+   SemantResult *check();
    void dump(ostream& stream, int n);
 
 #ifdef Program_SHARED_EXTRAS
@@ -183,22 +257,18 @@ protected:
    Symbol name;
    Symbol parent;
    Features features;
+   std::vector<Feature> feature_list;
    Symbol filename;
-   bool marked;
-   SymbolTable<Symbol, Symbol> *object_table;
-   std::map<Symbol, Feature> *method_table;
-   std::list<Class_> *children;
+   ScopedEnv *object_table;
+   MethodTable *method_table;
 public:
    class__class(Symbol a1, Symbol a2, Features a3, Symbol a4) {
       name = a1;
       parent = a2;
       features = a3;
+      flatten_list(features, feature_list);
       filename = a4;
-      marked = false;
-      object_table = new SymbolTable<Symbol, Symbol>();
-      object_table->enterscope();
-      method_table = new std::map<Symbol, Feature>();
-      children = new std::list<Class_>();
+      release_tables();
    }
    Symbol get_name() {
      return name;
@@ -206,22 +276,22 @@ public:
    Symbol get_parent() {
      return parent;
    }
-   bool get_marked() {
-     return marked;
-   }
-   SymbolTable<Symbol, Symbol> * get_object_table() {
+   ScopedEnv * get_object_table() {
      return object_table;
    }
-   std::map<Symbol, Feature> * get_method_table() {
+   std::vector<Feature> * get_feature_list() {
+     return &feature_list;
+   }
+   MethodTable * get_method_table() {
      return method_table;
    }
-   int check_cycle();
-   int check_attrs();
-   void semant();
-   Symbol get_attr(Symbol var);
-   Feature get_method(Symbol method);
-   int get_environment();
-   void add_child(Class_ class_);
+   int check_attrs(SemantContextP ctx);
+   void semant(SemantContextP ctx);
+   int get_weight();
+   void install_tables(Arena *arena);
+   void release_tables();
+   size_t release_scratch();
+   int get_environment(SemantContextP ctx);
    Class_ copy_Class_();
    void dump(ostream& stream, int n);
 
@@ -239,30 +309,54 @@ class method_class : public Feature_class {
 protected:
    Symbol name;
    Formals formals;
+   std::vector<Formal> formal_list;
    Symbol return_type;
    Expression expr;
+   MethodSignature *signature;
 public:
    method_class(Symbol a1, Formals a2, Symbol a3, Expression a4) {
       name = a1;
       formals = a2;
+      flatten_list(formals, formal_list);
       return_type = a3;
       expr = a4;
+      signature = NULL;
    }
-   int check_attrs();
-   int get_environment();
+   int check_attrs(SemantContextP ctx);
+   int get_environment(SemantContextP ctx);
    Symbol get_name () {
      return name;
    }
+   bool is_method() {
+     return true;
+   }
    Symbol get_return_type() {
      return return_type;
    }
+   Symbol get_type_decl() {
+     return NULL;
+   }
    Formals get_formals() {
      return formals;
    };
+   std::vector<Formal> *get_formal_list() {
+     return &formal_list;
+   }
+   Expression get_expr() {
+     return expr;
+   }
    Symbol get_arg_type(int i);
    int get_arg_len();
+   /* Set by get_environment; it lives in the analysis's arena, so it is
+      cleared again when the analysis ends */
+   MethodSignature *get_signature() {
+     return signature;
+   }
+   void release_signature() {
+     signature = NULL;
+   }
    Feature copy_Feature();
-   void semant();
+   void semant(SemantContextP ctx);
    void dump(ostream& stream, int n);
 
 #ifdef Feature_SHARED_EXTRAS
@@ -286,24 +380,40 @@ public:
       type_decl = a2;
       init = a3;
    }
-   int check_attrs();
-   int get_environment();
+   int check_attrs(SemantContextP ctx);
+   int get_environment(SemantContextP ctx);
    Symbol get_name () {
      return name;
    }
+   bool is_method() {
+     return false;
+   }
    Symbol get_return_type() {
      return NULL;
    }
+   Symbol get_type_decl() {
+     return type_decl;
+   }
    Symbol get_arg_type(int i) {
      return NULL;
    };
    int get_arg_len() {
      return 0;
    };
+   MethodSignature *get_signature() {
+     return NULL;
+   }
+   void release_signature() { }
    Formals get_formals() {
      return NULL;
    };
-   void semant();
+   std::vector<Formal> *get_formal_list() {
+     return NULL;
+   }
+   Expression get_expr() {
+     return init;
+   }
+   void semant(SemantContextP ctx);
    Feature copy_Feature();
    void dump(ostream& stream, int n);
 
@@ -326,7 +436,7 @@ public:
       name = a1;
       type_decl = a2;
    }
-   void semant();
+   void semant(SemantContextP ctx);
    Symbol get_name() {
      return name;
    }
@@ -357,7 +467,11 @@ public:
       type_decl = a2;
       expr = a3;
    }
-   void semant();
+   void enter_scope(SemantContextP ctx);
+   void exit_scope(SemantContextP ctx);
+   Symbol get_name() {
+     return name;
+   }
    Symbol get_type_decl() {
      return type_decl;
    };
@@ -383,10 +497,17 @@ protected:
    Expression expr;
 public:
    assign_class(Symbol a1, Expression a2) {
+      kind = EXPR_ASSIGN;
       name = a1;
       expr = a2;
    }
-   void semant();
+   Symbol get_name() {
+     return name;
+   }
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+     children.push_back(expr);
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -406,14 +527,29 @@ protected:
    Symbol type_name;
    Symbol name;
    Expressions actual;
+   std::vector<Expression> actual_list;
+   Feature target;
 public:
    static_dispatch_class(Expression a1, Symbol a2, Symbol a3, Expressions a4) {
+      kind = EXPR_STATIC_DISPATCH;
       expr = a1;
       type_name = a2;
       name = a3;
       actual = a4;
+      flatten_list(actual, actual_list);
+      target = NULL;
+   }
+   Symbol get_type_name() {
+     return type_name;
    }
-   void semant();
+   Symbol get_name() {
+     return name;
+   }
+   std::vector<Expression> *get_actual_list() {
+     return &actual_list;
+   }
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children);
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -432,13 +568,25 @@ protected:
    Expression expr;
    Symbol name;
    Expressions actual;
+   std::vector<Expression> actual_list;
+   Feature target;
 public:
    dispatch_class(Expression a1, Symbol a2, Expressions a3) {
+      kind = EXPR_DISPATCH;
       expr = a1;
       name = a2;
       actual = a3;
+      flatten_list(actual, actual_list);
+      target = NULL;
    }
-   void semant();
+   Symbol get_name() {
+     return name;
+   }
+   std::vector<Expression> *get_actual_list() {
+     return &actual_list;
+   }
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children);
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -459,11 +607,17 @@ protected:
    Expression else_exp;
 public:
    cond_class(Expression a1, Expression a2, Expression a3) {
+      kind = EXPR_COND;
       pred = a1;
       then_exp = a2;
       else_exp = a3;
    }
-   void semant();
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+     children.push_back(pred);
+     children.push_back(then_exp);
+     children.push_back(else_exp);
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -483,10 +637,15 @@ protected:
    Expression body;
 public:
    loop_class(Expression a1, Expression a2) {
+      kind = EXPR_LOOP;
       pred = a1;
       body = a2;
    }
-   void semant();
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+     children.push_back(pred);
+     children.push_back(body);
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -504,13 +663,27 @@ class typcase_class : public Expression_class {
 protected:
    Expression expr;
    Cases cases;
+   std::vector<Case> case_list;
+   std::vector<Case> dispatch_order;
 public:
    typcase_class(Expression a1, Cases a2) {
+      kind = EXPR_TYPCASE;
       expr = a1;
       cases = a2;
+      flatten_list(cases, case_list);
+   }
+   std::vector<Case> *get_case_list() {
+     return &case_list;
    }
-   int check_dups();
-   void semant();
+   /* The branches, most derived type first; filled in by the checker */
+   std::vector<Case> *get_dispatch_order() {
+     return &dispatch_order;
+   }
+   int check_dups(SemantContextP ctx);
+   void check_reachable(SemantContextP ctx);
+   void order_branches(SemantContextP ctx);
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children);
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -527,11 +700,18 @@ public:
 class block_class : public Expression_class {
 protected:
    Expressions body;
+   std::vector<Expression> body_list;
 public:
    block_class(Expressions a1) {
+      kind = EXPR_BLOCK;
       body = a1;
+      flatten_list(body, body_list);
+   }
+   std::vector<Expression> *get_body_list() {
+     return &body_list;
    }
-   void semant();
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children);
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -553,12 +733,23 @@ protected:
    Expression body;
 public:
    let_class(Symbol a1, Symbol a2, Expression a3, Expression a4) {
+      kind = EXPR_LET;
       identifier = a1;
       type_decl = a2;
       init = a3;
       body = a4;
    }
-   void semant();
+   Symbol get_identifier() {
+     return identifier;
+   }
+   Symbol get_type_decl() {
+     return type_decl;
+   }
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+     children.push_back(init);
+     children.push_back(body);
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -578,10 +769,15 @@ protected:
    Expression e2;
 public:
    plus_class(Expression a1, Expression a2) {
+      kind = EXPR_PLUS;
       e1 = a1;
       e2 = a2;
    }
-   void semant();
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+     children.push_back(e1);
+     children.push_back(e2);
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -601,10 +797,15 @@ protected:
    Expression e2;
 public:
    sub_class(Expression a1, Expression a2) {
+      kind = EXPR_SUB;
       e1 = a1;
       e2 = a2;
    }
-   void semant();
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+     children.push_back(e1);
+     children.push_back(e2);
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -624,10 +825,15 @@ protected:
    Expression e2;
 public:
    mul_class(Expression a1, Expression a2) {
+      kind = EXPR_MUL;
       e1 = a1;
       e2 = a2;
    }
-   void semant();
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+     children.push_back(e1);
+     children.push_back(e2);
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -647,10 +853,15 @@ protected:
    Expression e2;
 public:
    divide_class(Expression a1, Expression a2) {
+      kind = EXPR_DIVIDE;
       e1 = a1;
       e2 = a2;
    }
-   void semant();
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+     children.push_back(e1);
+     children.push_back(e2);
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -669,9 +880,13 @@ protected:
    Expression e1;
 public:
    neg_class(Expression a1) {
+      kind = EXPR_NEG;
       e1 = a1;
    }
-   void semant();
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+     children.push_back(e1);
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -691,10 +906,15 @@ protected:
    Expression e2;
 public:
    lt_class(Expression a1, Expression a2) {
+      kind = EXPR_LT;
       e1 = a1;
       e2 = a2;
    }
-   void semant();
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+     children.push_back(e1);
+     children.push_back(e2);
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -714,10 +934,15 @@ protected:
    Expression e2;
 public:
    eq_class(Expression a1, Expression a2) {
+      kind = EXPR_EQ;
       e1 = a1;
       e2 = a2;
    }
-   void semant();
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+     children.push_back(e1);
+     children.push_back(e2);
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -737,10 +962,15 @@ protected:
    Expression e2;
 public:
    leq_class(Expression a1, Expression a2) {
+      kind = EXPR_LEQ;
       e1 = a1;
       e2 = a2;
    }
-   void semant();
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+     children.push_back(e1);
+     children.push_back(e2);
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -759,9 +989,13 @@ protected:
    Expression e1;
 public:
    comp_class(Expression a1) {
+      kind = EXPR_COMP;
       e1 = a1;
    }
-   void semant();
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+     children.push_back(e1);
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -780,9 +1014,15 @@ protected:
    Symbol token;
 public:
    int_const_class(Symbol a1) {
+      kind = EXPR_INT_CONST;
       token = a1;
    }
-   void semant();
+   Symbol get_token() {
+     return token;
+   }
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -801,9 +1041,15 @@ protected:
    Boolean val;
 public:
    bool_const_class(Boolean a1) {
+      kind = EXPR_BOOL_CONST;
       val = a1;
    }
-   void semant();
+   Boolean get_val() {
+     return val;
+   }
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -822,9 +1068,15 @@ protected:
    Symbol token;
 public:
    string_const_class(Symbol a1) {
+      kind = EXPR_STRING_CONST;
       token = a1;
    }
-   void semant();
+   Symbol get_token() {
+     return token;
+   }
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -843,9 +1095,15 @@ protected:
    Symbol type_name;
 public:
    new__class(Symbol a1) {
+      kind = EXPR_NEW;
       type_name = a1;
    }
-   void semant();
+   Symbol get_type_name() {
+     return type_name;
+   }
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -864,9 +1122,13 @@ protected:
    Expression e1;
 public:
    isvoid_class(Expression a1) {
+      kind = EXPR_ISVOID;
       e1 = a1;
    }
-   void semant();
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+     children.push_back(e1);
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -884,8 +1146,11 @@ class no_expr_class : public Expression_class {
 protected:
 public:
    no_expr_class() {
+      kind = EXPR_NO_EXPR;
+   }
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
    }
-   void semant();
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -904,9 +1169,15 @@ protected:
    Symbol name;
 public:
    object_class(Symbol a1) {
+      kind = EXPR_OBJECT;
       name = a1;
    }
-   void semant();
+   Symbol get_name() {
+     return name;
+   }
+   Expression semant_step(SemantContextP ctx, int &state);
+   void get_children(std::vector<Expression> &children) {
+   }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
 
@@ -0,0 +1,220 @@
+//////////////////////////////////////////////////////////////////////
+//
+// semant-batch: semantically checks many programs in one process.
+//
+//    semant-batch [-j jobs] [-s] [-m] [-w] [-b] manifest
+//
+// The manifest names one AST file (parser output) per line; blank
+// lines and lines starting with '#' are skipped.  A file in the binary
+// form of ast-binary.h is mapped and loaded into its own arena instead
+// of being parsed.  The files are read one after another, since the AST
+// parser and the string tables are not thread-safe, and then checked
+// concurrently, jobs programs at a time.  Every analysis shares the
+// interned constants and the basic class prelude; each program's class
+// bodies are checked serially.
+//
+// For each input path, path.err receives its diagnostics (and the
+// statistics with -s), and path.out the typed AST when it checks
+// cleanly.  A summary line per input goes to stdout in manifest order.
+// The exit status is nonzero if any input fails.
+//
+// -m frees each class's scratch tables as soon as it is checked; -w
+// adds warnings to the diagnostics; -b writes the typed AST to path.bin
+// in the binary form of ast-binary.h instead.
+//
+// Link it in place of semant-phase.cc.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "ast-binary.h"
+#include "cool-tree.h"
+#include "semant.h"
+#include "utilities.h"
+
+extern int ast_yyparse(void);
+extern void ast_yyrestart(FILE *input_file);
+extern Program ast_root;
+
+FILE *ast_file = stdin;
+int cool_yydebug;
+char *curr_filename = (char *) "<batch>";
+
+struct BatchInput {
+  std::string path;
+  Program program;	/* NULL if the file could not be read or parsed */
+  int weight;
+  int errors;
+};
+
+/* Checking one program is one pool task */
+class ProgramChecks : public PoolTasks {
+private:
+  std::vector<BatchInput> &inputs;
+  bool binary;
+
+public:
+  ProgramChecks(std::vector<BatchInput> &inputs, bool binary) : inputs(inputs), binary(binary) { }
+  void run(int worker, int task);
+};
+
+void ProgramChecks::run(int worker, int task)
+{
+  BatchInput &input = inputs[task];
+  if (input.program == NULL) {
+    return;
+  }
+
+  std::ofstream err((input.path + ".err").c_str());
+  SemantResult *result = input.program->check();
+  result->print(err);
+  if (semant_stats) {
+    result->print_stats(err);
+  }
+  input.errors = result->get_errors();
+  delete result;
+
+  if (input.errors) {
+    err << "Compilation halted due to static semantic errors." << endl;
+  } else if (binary) {
+    std::ofstream out((input.path + ".bin").c_str(), std::ios::binary);
+    dump_binary(input.program, out);
+  } else {
+    std::ofstream out((input.path + ".out").c_str());
+    input.program->dump_with_types(out, 0);
+  }
+}
+
+static bool read_manifest(char *manifest, std::vector<BatchInput> &inputs)
+{
+  std::ifstream in(manifest);
+  if (!in) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string::npos || line[start] == '#') {
+      continue;
+    }
+    size_t end = line.find_last_not_of(" \t\r");
+    BatchInput input;
+    input.path = line.substr(start, end - start + 1);
+    input.program = NULL;
+    input.weight = 0;
+    input.errors = 0;
+    inputs.push_back(input);
+  }
+  return true;
+}
+
+static bool is_binary(const std::string &path)
+{
+  char magic[sizeof(AstHeader::magic)];
+  std::ifstream in(path.c_str(), std::ios::binary);
+  return in.read(magic, sizeof(magic)) && memcmp(magic, AST_MAGIC, sizeof(magic)) == 0;
+}
+
+/* The parser reads stdin, so each input in turn is reopened onto it */
+static Program parse(BatchInput &input)
+{
+  struct stat info;
+  if (stat(input.path.c_str(), &info) != 0) {
+    return NULL;
+  }
+  input.weight = (int) std::min((off_t) 0x7fffffff, info.st_size);
+  if (is_binary(input.path)) {
+    /* The nodes live as long as the process, like the parser's */
+    return read_binary_ast(input.path.c_str(), new Arena());
+  }
+  if (freopen(input.path.c_str(), "r", stdin) == NULL) {
+    return NULL;
+  }
+  ast_root = NULL;
+  ast_yyrestart(stdin);
+  if (ast_yyparse() != 0) {
+    return NULL;
+  }
+  return ast_root;
+}
+
+static void usage(char *prog)
+{
+  cerr << "usage: " << prog << " [-j jobs] [-s] [-m] [-w] [-b] manifest" << endl;
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  int jobs = 1;
+  bool binary = false;
+  int c;
+
+  while ((c = getopt(argc, argv, "j:smwb")) != -1) {
+    switch (c) {
+    case 'j':
+      jobs = atoi(optarg);
+      break;
+    case 's':
+      semant_stats = 1;
+      break;
+    case 'm':
+      semant_low_memory = 1;
+      break;
+    case 'w':
+      semant_warnings = 1;
+      break;
+    case 'b':
+      binary = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+  }
+
+  std::vector<BatchInput> inputs;
+  if (!read_manifest(argv[optind], inputs)) {
+    cerr << argv[0] << ": cannot read " << argv[optind] << endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<int> weights;
+  for (std::vector<BatchInput>::iterator it = inputs.begin(); it != inputs.end(); it++) {
+    it->program = parse(*it);
+    weights.push_back(it->weight);
+  }
+
+  /* The programs are checked side by side, not their classes */
+  semant_jobs = 1;
+  if (!inputs.empty()) {
+    ProgramChecks checks(inputs, binary);
+    WorkStealingPool pool(std::max(1, std::min(jobs, (int) inputs.size())));
+    pool.run(&checks, weights);
+  }
+
+  int failed = 0;
+  for (std::vector<BatchInput>::iterator it = inputs.begin(); it != inputs.end(); it++) {
+    cout << it->path << ": ";
+    if (it->program == NULL) {
+      cout << "cannot read or parse" << endl;
+      failed++;
+    } else if (it->errors) {
+      cout << it->errors << " error" << (it->errors == 1 ? "" : "s") << endl;
+      failed++;
+    } else {
+      cout << "ok" << endl;
+    }
+  }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
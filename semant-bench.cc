@@ -0,0 +1,314 @@
+//////////////////////////////////////////////////////////////////////
+//
+// semant-bench: times the semantic checker on generated programs.
+//
+// Builds synthetic Cool ASTs of a given shape and size, runs
+// Program::check() on each a number of times and reports the fastest
+// time of every pass, as CSV (default) or JSON:
+//
+//    semant-bench [-f csv|json] [-r reps] [-j jobs] [-s n,n,...]
+//                 [-e virtual|tagged|both] [shape ...]
+//
+// Shapes:
+//    chain     n classes, each inheriting from the previous one
+//    wide      one class with n attributes and n methods
+//    body      one method whose body is a block of n assignments
+//    case      a case expression with n branches over n classes
+//    let       n nested lets
+//    dispatch  a block of n dynamic and static dispatches
+//
+// Engines (-e, default both):
+//    virtual   each expression node is stepped through a virtual call
+//    tagged    a switch on the node kind calls each rule directly
+//
+// Link it in place of semant-phase.cc.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "cool-tree.h"
+#include "semant.h"
+#include "utilities.h"
+
+FILE *ast_file = stdin;
+int cool_yydebug;
+char *curr_filename = (char *) "<bench>";
+
+static Symbol filename;
+
+static Symbol name(const char *prefix, int n = -1)
+{
+  char buf[64];
+  if (n < 0) {
+    snprintf(buf, sizeof(buf), "%s", prefix);
+  } else {
+    snprintf(buf, sizeof(buf), "%s%d", prefix, n);
+  }
+  return idtable.add_string(buf);
+}
+
+static Expression int_lit(int n)
+{
+  return int_const(inttable.add_int(n));
+}
+
+/* Lists grow at the end, the way the parser builds them */
+static Features add_feature(Features list, Feature feature)
+{
+  return append_Features(list, single_Features(feature));
+}
+
+static Expressions add_expr(Expressions list, Expression expr)
+{
+  return append_Expressions(list, single_Expressions(expr));
+}
+
+static Classes add_class(Classes list, Class_ class_)
+{
+  return append_Classes(list, single_Classes(class_));
+}
+
+static Class_ main_class(Symbol parent, Expression body, Features features)
+{
+  features = add_feature(features, method(name("main"), nil_Formals(), name("Object"), body));
+  return class_(name("Main"), parent, features, filename);
+}
+
+static Program gen_chain(int n)
+{
+  Classes classes = nil_Classes();
+  Symbol parent = name("Object");
+  for (int i = 0; i < n; i++) {
+    Features features = single_Features(attr(name("a", i), name("Int"), int_lit(i)));
+    features = add_feature(features, method(name("f"), nil_Formals(), name("Int"), object(name("a", i))));
+    classes = add_class(classes, class_(name("C", i), parent, features, filename));
+    parent = name("C", i);
+  }
+  Expression body = dispatch(object(name("self")), name("f"), nil_Expressions());
+  return program(add_class(classes, main_class(parent, body, nil_Features())));
+}
+
+static Program gen_wide(int n)
+{
+  Features features = nil_Features();
+  for (int i = 0; i < n; i++) {
+    features = add_feature(features, attr(name("a", i), name("Int"), int_lit(i)));
+    features = add_feature(features, method(name("m", i), single_Formals(formal(name("x"), name("Int"))), name("Int"),
+					    plus(object(name("x")), object(name("a", i)))));
+  }
+  return program(single_Classes(main_class(name("Object"), int_lit(0), features)));
+}
+
+static Program gen_body(int n)
+{
+  Expressions body = nil_Expressions();
+  for (int i = 0; i < n; i++) {
+    body = add_expr(body, assign(name("x"), plus(object(name("x")), int_lit(i))));
+  }
+  Features features = single_Features(attr(name("x"), name("Int"), no_expr()));
+  return program(single_Classes(main_class(name("Object"), block(body), features)));
+}
+
+static Program gen_case(int n)
+{
+  Classes classes = nil_Classes();
+  Cases cases = nil_Cases();
+  for (int i = 0; i < n; i++) {
+    classes = add_class(classes, class_(name("K", i), name("Object"), nil_Features(), filename));
+    cases = append_Cases(cases, single_Cases(branch(name("b", i), name("K", i), int_lit(i))));
+  }
+  Expression body = typcase(new_(name("K", 0)), cases);
+  return program(add_class(classes, main_class(name("Object"), body, nil_Features())));
+}
+
+static Program gen_let(int n)
+{
+  Expression body = plus(object(name("v", 0)), object(name("v", n - 1)));
+  for (int i = n - 1; i >= 0; i--) {
+    body = let(name("v", i), name("Int"), int_lit(i), body);
+  }
+  return program(single_Classes(main_class(name("Object"), body, nil_Features())));
+}
+
+static Program gen_dispatch(int n)
+{
+  Formals formals = append_Formals(single_Formals(formal(name("p"), name("Int"))),
+				   single_Formals(formal(name("q"), name("Int"))));
+  Features features = single_Features(method(name("f"), formals, name("Int"),
+					     plus(object(name("p")), object(name("q")))));
+  Expressions body = nil_Expressions();
+  for (int i = 0; i < n; i++) {
+    Expressions actual = append_Expressions(single_Expressions(int_lit(i)), single_Expressions(int_lit(i + 1)));
+    if (i % 2 == 0) {
+      body = add_expr(body, dispatch(object(name("self")), name("f"), actual));
+    } else {
+      body = add_expr(body, static_dispatch(object(name("self")), name("Main"), name("f"), actual));
+    }
+  }
+  return program(single_Classes(main_class(name("Object"), block(body), features)));
+}
+
+struct Shape {
+  const char *name;
+  Program (*generate)(int n);
+};
+
+static Shape shapes[] = {
+  { "chain", gen_chain },
+  { "wide", gen_wide },
+  { "body", gen_body },
+  { "case", gen_case },
+  { "let", gen_let },
+  { "dispatch", gen_dispatch },
+};
+
+#define SHAPES ((int) (sizeof(shapes) / sizeof(shapes[0])))
+
+struct Engine {
+  const char *name;
+  int tagged;
+};
+
+static Engine engines[] = {
+  { "virtual", 0 },
+  { "tagged", 1 },
+};
+
+#define ENGINES ((int) (sizeof(engines) / sizeof(engines[0])))
+
+/* Fastest time of every pass over reps runs, in pass order */
+static int bench(Program program, int reps, std::vector<SemantPhaseTime> &best)
+{
+  int errors = 0;
+
+  best.clear();
+  for (int rep = 0; rep < reps; rep++) {
+    SemantResult *result = program->check();
+    std::vector<SemantPhaseTime> *times = result->get_phase_times();
+    for (size_t i = 0; i < times->size(); i++) {
+      if (i == best.size()) {
+	best.push_back((*times)[i]);
+      } else if ((*times)[i].seconds < best[i].seconds) {
+	best[i].seconds = (*times)[i].seconds;
+      }
+    }
+    errors = result->get_errors();
+    delete result;
+  }
+  return errors;
+}
+
+static void usage(char *prog)
+{
+  cerr << "usage: " << prog << " [-f csv|json] [-r reps] [-j jobs] [-s n,n,...] [-e virtual|tagged|both] [shape ...]" << endl;
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  bool json = false;
+  int reps = 3;
+  std::vector<int> sizes;
+  std::vector<Shape *> selected;
+  std::vector<Engine *> selected_engines;
+  int c;
+
+  while ((c = getopt(argc, argv, "f:r:j:s:e:")) != -1) {
+    switch (c) {
+    case 'f':
+      json = strcmp(optarg, "json") == 0;
+      break;
+    case 'r':
+      reps = atoi(optarg);
+      break;
+    case 'j':
+      semant_jobs = atoi(optarg);
+      break;
+    case 's':
+      for (char *size = strtok(optarg, ","); size != NULL; size = strtok(NULL, ",")) {
+	sizes.push_back(atoi(size));
+      }
+      break;
+    case 'e':
+      for (int k = 0; k < ENGINES; k++) {
+	if (strcmp(optarg, "both") == 0 || strcmp(optarg, engines[k].name) == 0) {
+	  selected_engines.push_back(&engines[k]);
+	}
+      }
+      if (selected_engines.empty()) {
+	usage(argv[0]);
+      }
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  for (int i = optind; i < argc; i++) {
+    int k;
+    for (k = 0; k < SHAPES && strcmp(shapes[k].name, argv[i]) != 0; k++)
+      ;
+    if (k == SHAPES) {
+      usage(argv[0]);
+    }
+    selected.push_back(&shapes[k]);
+  }
+  if (selected.empty()) {
+    for (int k = 0; k < SHAPES; k++) {
+      selected.push_back(&shapes[k]);
+    }
+  }
+  if (selected_engines.empty()) {
+    for (int k = 0; k < ENGINES; k++) {
+      selected_engines.push_back(&engines[k]);
+    }
+  }
+  if (sizes.empty()) {
+    sizes.push_back(100);
+    sizes.push_back(1000);
+    sizes.push_back(4000);
+  }
+  if (reps < 1) {
+    reps = 1;
+  }
+  filename = stringtable.add_string(curr_filename);
+
+  const char *sep = "";
+  if (json) {
+    cout << "[";
+  } else {
+    cout << "shape,size,engine,jobs,errors,phase,seconds" << endl;
+  }
+  for (std::vector<Shape *>::iterator shape = selected.begin(); shape != selected.end(); shape++) {
+    for (std::vector<int>::iterator size = sizes.begin(); size != sizes.end(); size++) {
+      /* Every engine checks the very same tree */
+      node_lineno = 1;
+      Program program = (*shape)->generate(*size);
+      for (std::vector<Engine *>::iterator engine = selected_engines.begin(); engine != selected_engines.end(); engine++) {
+	std::vector<SemantPhaseTime> best;
+	semant_tagged = (*engine)->tagged;
+	int errors = bench(program, reps, best);
+	for (std::vector<SemantPhaseTime>::iterator it = best.begin(); it != best.end(); it++) {
+	  if (json) {
+	    cout << sep << "\n  {\"shape\": \"" << (*shape)->name << "\", \"size\": " << *size
+		 << ", \"engine\": \"" << (*engine)->name << "\", \"jobs\": " << semant_jobs
+		 << ", \"errors\": " << errors
+		 << ", \"phase\": \"" << it->phase << "\", \"seconds\": " << it->seconds << "}";
+	    sep = ",";
+	  } else {
+	    cout << (*shape)->name << "," << *size << "," << (*engine)->name << "," << semant_jobs << ","
+		 << errors << "," << it->phase << "," << it->seconds << endl;
+	  }
+	}
+      }
+    }
+  }
+  if (json) {
+    cout << "\n]" << endl;
+  }
+  return 0;
+}
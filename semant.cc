@@ -3,19 +3,27 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include "semant.h"
 #include "utilities.h"
 
-#define ERROR(str)         curr_classtable->semant_error(curr_class);           \
-                           cerr << str << endl;
-#define SEMANT_ERROR(str)  curr_classtable->semant_error(curr_class);           \
-                           cerr << str << endl;                                 \
+#define ERROR(str)         ctx->semant_error(ctx->get_class()) << str << endl;
+#define COUNT(counter)     if (semant_stats) counters.counter++;
+#define SEMANT_ERROR(str)  ctx->semant_error(ctx->get_class()) << str << endl;  \
 			   type = Object;
 
 extern int semant_debug;
 extern char *curr_filename;
-static Class__class *curr_class;
-static ClassTable *curr_classtable;
+int semant_jobs = 1;
+int semant_stats = 0;
+int semant_low_memory = 0;
+int semant_tagged = 0;
+int semant_warnings = 0;
 //////////////////////////////////////////////////////////////////////
 //
 // Symbols
@@ -24,6 +32,10 @@ static ClassTable *curr_classtable;
 // These symbols include the primitive type and method names, as well
 // as fixed names used by the runtime system.
 //
+// They are interned once per process, the first time a program is
+// checked; symbols are unique per name, so every later test against
+// them is a single pointer compare.
+//
 //////////////////////////////////////////////////////////////////////
 static Symbol 
     arg,
@@ -51,7 +63,8 @@ static Symbol
     str_field,
     substr,
     type_name,
-    val;
+    val,
+    basic_filename;
 //
 // Initializing the predefined symbols.
 //
@@ -85,20 +98,235 @@ static void initialize_constants(void)
     substr      = idtable.add_string("substr");
     type_name   = idtable.add_string("type_name");
     val         = idtable.add_string("_val");
+
+    basic_filename = stringtable.add_string("<basic class>");
+}
+
+static std::once_flag constants_initialized;
+
+Arena::Arena() : next(NULL), limit(NULL)
+{
+  blocks = new std::vector<char *>;
+  finalizers = new std::vector<Finalizer>;
+}
+
+Arena::~Arena()
+{
+  for (std::vector<Finalizer>::reverse_iterator it = finalizers->rbegin(); it != finalizers->rend(); it++) {
+    it->destroy(it->object);
+  }
+  for (std::vector<char *>::iterator it = blocks->begin(); it != blocks->end(); it++) {
+    delete[] *it;
+  }
+  delete finalizers;
+  delete blocks;
+}
+
+/* Requests too large for a block get a block of their own */
+void *Arena::allocate(size_t size, size_t align)
+{
+  char *start = (char *) (((size_t) next + align - 1) & ~(align - 1));
+  if (next == NULL || start + size > limit) {
+    size_t block_size = std::max((size_t) ARENA_BLOCK_SIZE, size + align);
+    char *block = new char[block_size];
+    blocks->push_back(block);
+    next = block;
+    limit = block + block_size;
+    start = (char *) (((size_t) next + align - 1) & ~(align - 1));
+  }
+  next = start + size;
+  return start;
+}
+
+/* Names stay in head with -1 once unbound, so rebinding them allocates nothing */
+void ScopedEnv::exitscope()
+{
+  int mark = marks.back();
+  marks.pop_back();
+  while ((int) bindings.size() > mark) {
+    Binding &binding = bindings.back();
+    head[binding.name] = binding.shadowed;
+    bindings.pop_back();
+  }
+}
+
+void ScopedEnv::addid(Symbol name, Symbol type)
+{
+  std::pair<ArenaHashMap<Symbol, int>::iterator, bool> slot =
+    head.insert(std::pair<Symbol, int>(name, -1));
+  Binding binding = { name, type, slot.first->second };
+  slot.first->second = bindings.size();
+  bindings.push_back(binding);
+}
+
+/* Type of the innermost binding of name, or NULL if it is not bound */
+Symbol ScopedEnv::lookup(Symbol name)
+{
+  ArenaHashMap<Symbol, int>::iterator it = head.find(name);
+  if (it == head.end() || it->second == -1) {
+    return NULL;
+  }
+  return bindings[it->second].type;
+}
+
+/*
+ * Frees all bindings and returns roughly how many bytes that gave back.  Only
+ * a table on the heap gives anything back; see class__class::install_tables.
+ */
+size_t ScopedEnv::release()
+{
+  size_t bytes = bindings.capacity() * sizeof(Binding) + marks.capacity() * sizeof(int) +
+    head.bucket_count() * sizeof(void *) + head.size() * (sizeof(std::pair<const Symbol, int>) + 2 * sizeof(void *));
+  ArenaVector<Binding>(bindings.get_allocator()).swap(bindings);
+  ArenaVector<int>(marks.get_allocator()).swap(marks);
+  ArenaHashMap<Symbol, int>(head.get_allocator()).swap(head);
+  return bytes;
+}
+
+/* Whether name is bound in the innermost scope */
+bool ScopedEnv::probe(Symbol name)
+{
+  ArenaHashMap<Symbol, int>::iterator it = head.find(name);
+  return it != head.end() && it->second != -1 && it->second >= marks.back();
+}
+
+ClassIndex::ClassIndex(Arena *arena) : arena(arena), count(0)
+{
+  keys = arena->make<ArenaVector<Symbol> >(64, (Symbol) NULL, arena);
+  ids = arena->make<ArenaVector<int> >(64, -1, arena);
+}
+
+static inline size_t hash_symbol(Symbol name)
+{
+  size_t h = (size_t) name;
+  h ^= h >> 17;
+  h *= 0x9e3779b97f4a7c15ULL;
+  return h ^ (h >> 29);
+}
+
+/* The basic classes' signatures; read-only once the prelude is built */
+static SignatureTable *prelude_signatures;
+
+MethodSignature *MethodSignature::find(SignatureTable *table, unsigned long long fingerprint, std::vector<Symbol> &types)
+{
+  SignatureTable::iterator it = table->find(fingerprint);
+  if (it == table->end()) {
+    return NULL;
+  }
+  for (ArenaVector<MethodSignature *>::iterator itt = it->second.begin(); itt != it->second.end(); itt++) {
+    if ((*itt)->types.size() == types.size() && std::equal(types.begin(), types.end(), (*itt)->types.begin())) {
+      return *itt;
+    }
+  }
+  return NULL;
+}
+
+MethodSignature *MethodSignature::intern(SemantContextP ctx, Feature method)
+{
+  std::vector<Symbol> types;
+  unsigned long long fingerprint = method->get_arg_len();
+  for (int i = 0; i < method->get_arg_len(); i++) {
+    types.push_back(method->get_arg_type(i));
+  }
+  types.push_back(method->get_return_type());
+  for (std::vector<Symbol>::iterator it = types.begin(); it != types.end(); it++) {
+    fingerprint = (fingerprint ^ hash_symbol(*it)) * 0x100000001b3ULL;
+  }
+
+  MethodSignature *signature = NULL;
+  if (prelude_signatures != NULL) {
+    signature = find(prelude_signatures, fingerprint, types);
+  }
+  if (signature == NULL) {
+    signature = find(ctx->get_signatures(), fingerprint, types);
+  }
+  if (signature == NULL) {
+    signature = ctx->get_arena()->make<MethodSignature>(types, fingerprint, ctx->get_arena());
+    (*ctx->get_signatures())[fingerprint].push_back(signature);
+  }
+  return signature;
 }
 
-ClassTable::ClassTable() : semant_errors(0) , error_stream(cerr)
+/* Linear probing over a power-of-two table that is never more than half full */
+int ClassIndex::find(Symbol name)
 {
-  class_table = new std::map<Symbol, Class_>;
+  size_t mask = keys->size() - 1;
+  for (size_t i = hash_symbol(name) & mask; (*keys)[i] != NULL; i = (i + 1) & mask) {
+    if ((*keys)[i] == name) {
+      return (*ids)[i];
+    }
+  }
+  return -1;
+}
+
+void ClassIndex::insert(Symbol name, int id)
+{
+  if (2 * (count + 1) > (int) keys->size()) {
+    grow();
+  }
+  size_t mask = keys->size() - 1;
+  size_t i = hash_symbol(name) & mask;
+  while ((*keys)[i] != NULL) {
+    i = (i + 1) & mask;
+  }
+  (*keys)[i] = name;
+  (*ids)[i] = id;
+  count++;
 }
 
-int ClassTable::install_classes(Classes classes)
+void ClassIndex::grow()
+{
+  ArenaVector<Symbol> *old_keys = keys;
+  ArenaVector<int> *old_ids = ids;
+
+  keys = arena->make<ArenaVector<Symbol> >(2 * old_keys->size(), (Symbol) NULL, arena);
+  ids = arena->make<ArenaVector<int> >(2 * old_keys->size(), -1, arena);
+  count = 0;
+  for (size_t i = 0; i < old_keys->size(); i++) {
+    if ((*old_keys)[i] != NULL) {
+      insert((*old_keys)[i], (*old_ids)[i]);
+    }
+  }
+  ArenaVector<Symbol>(arena).swap(*old_keys);
+  ArenaVector<int>(arena).swap(*old_ids);
+}
+
+ClassTable::ClassTable(Arena *arena) : arena(arena)
+{
+  class_table = arena->make<ArenaVector<Class_> >(arena);
+  shared_classes = 0;
+  class_index = arena->make<ClassIndex>(arena);
+  object_id = -1;
+  parent_ids = arena->make<ArenaVector<int> >(arena);
+  child_start = arena->make<ArenaVector<int> >(arena);
+  child_list = arena->make<ArenaVector<int> >(arena);
+  pre = arena->make<ArenaVector<int> >(arena);
+  post = arena->make<ArenaVector<int> >(arena);
+  depth = arena->make<ArenaVector<int> >(arena);
+  ancestors = arena->make<ArenaVector<int> >(arena);
+  ancestor_levels = 0;
+  preorder = arena->make<ArenaVector<int> >(arena);
+  method_slots = arena->make<SlotTable>(arena);
+  dispatch_sizes = arena->make<ArenaVector<int> >(arena);
+  attr_slots = arena->make<SlotTable>(arena);
+  attr_counts = arena->make<ArenaVector<int> >(arena);
+}
+
+/* The per-class tables and signatures live in the arena, so drop them before it goes away */
+void ClassTable::release_tables()
+{
+  for (size_t id = shared_classes; id < class_table->size(); id++) {
+    (*class_table)[id]->release_tables();
+  }
+}
+
+int ClassTable::install_classes(SemantContextP ctx, std::vector<Class_> *classes)
 {
   install_basic_classes();
 
-  for(int i = classes->first(); classes->more(i); i = classes->next(i)) {
-    Class_ class_ = classes->nth(i);
-    if (install_class(class_->get_name(), class_)) {
+  for (std::vector<Class_>::iterator it = classes->begin(); it != classes->end(); it++) {
+    Class_ class_ = *it;
+    if (install_class(ctx, class_->get_name(), class_)) {
       return EXIT_FAILURE;
     }
   }
@@ -106,70 +334,72 @@ int ClassTable::install_classes(Classes classes)
 
 }
 
-int ClassTable::get_environment()
+int ClassTable::get_environment(SemantContextP ctx)
 {
-  Class_ class_;
-
-  for (std::map<Symbol, Class_>::iterator it = class_table->begin(); it != class_table->end(); it++) {
-    class_ = it->second;
-    if (class_->get_environment()) {
+  for (size_t id = shared_classes; id < class_table->size(); id++) {
+    if ((*class_table)[id]->get_environment(ctx)) {
       return EXIT_FAILURE;
     }
   }
   return EXIT_SUCCESS;
 }
 
-int ClassTable::generate_tree()
+int ClassTable::generate_tree(SemantContextP ctx)
 {
-  std::map<Symbol, Class_>::iterator pit;
-  Class_ parent;
+  int count = class_table->size();
+  int parent_id;
 
-  for (std::map<Symbol, Class_>::iterator it = class_table->begin(); it != class_table->end(); it++) {
-    curr_class = it->second;
-    if (curr_class->get_parent() == No_class) {
+  parent_ids->assign(count, -1);
+  child_start->assign(count + 1, 0);
+  for (int id = 0; id < count; id++) {
+    Class_ class_ = (*class_table)[id];
+    ctx->set_class(class_);
+    if (class_->get_parent() == No_class) {
       continue;
     }
-    if ((pit = class_table->find(curr_class->get_parent())) == class_table->end()) {
-      ERROR("No parent class " << curr_class->get_parent() << " found");
+    if ((parent_id = class_index->find(class_->get_parent())) == -1) {
+      ERROR("No parent class " << class_->get_parent() << " found");
       return EXIT_FAILURE;
     }
-    parent = pit->second;
-    parent->add_child(curr_class);
+    (*parent_ids)[id] = parent_id;
+    (*child_start)[parent_id + 1]++;
   }
-  return EXIT_SUCCESS;
-}
 
-int ClassTable::compare_methods(Feature method1, Feature method2)
-{
-  if (method1->get_arg_len() != method2->get_arg_len() ||
-      method1->get_return_type() != method2->get_return_type()) {
-    return EXIT_FAILURE;
+  /* Children of class id are child_list[child_start[id] .. child_start[id + 1]) */
+  for (int id = 0; id < count; id++) {
+    (*child_start)[id + 1] += (*child_start)[id];
   }
-  Formals formals = method1->get_formals();
-  for (int i = formals->first(); formals->more(i); i = formals->next(i)) {
-    Formal formal1 = method1->get_formals()->nth(i);
-    Formal formal2 = method2->get_formals()->nth(i);
-    if (formal1->get_type_decl() != formal2->get_type_decl()) {
-      return EXIT_FAILURE;
+  std::vector<int> next(child_start->begin(), child_start->end() - 1);
+  child_list->assign((*child_start)[count], -1);
+  for (int id = 0; id < count; id++) {
+    if ((*parent_ids)[id] != -1) {
+      (*child_list)[next[(*parent_ids)[id]]++] = id;
     }
   }
   return EXIT_SUCCESS;
 }
 
-int ClassTable::check_methods()
+/* Signatures are interned, so equal signatures are the same object */
+int ClassTable::compare_methods(Feature method1, Feature method2)
+{
+  return method1->get_signature() == method2->get_signature() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int ClassTable::check_methods(SemantContextP ctx)
 {
-  std::map<Symbol, Feature> *method_table;
+  MethodTable *method_table;
   Feature child_method, parent_method;
 
-  for (std::map<Symbol, Class_>::iterator it = class_table->begin(); it != class_table->end(); it++) {
-    curr_class = it->second;
-    if (curr_class->get_parent() == No_class) {
+  for (size_t id = shared_classes; id < class_table->size(); id++) {
+    Class_ class_ = (*class_table)[id];
+    ctx->set_class(class_);
+    if (class_->get_parent() == No_class) {
       continue;
     }
-    method_table = curr_class->get_method_table();
-    for (std::map<Symbol, Feature>::iterator itt = method_table->begin(); itt != method_table->end(); itt++) {
+    method_table = class_->get_method_table();
+    for (MethodTable::iterator itt = method_table->begin(); itt != method_table->end(); itt++) {
       child_method = itt->second;
-      parent_method = lookup_method(curr_class->get_parent(), child_method->get_name());
+      parent_method = ctx->lookup_method(class_->get_parent(), child_method->get_name());
       if (parent_method == NULL) {
 	continue;
       }
@@ -182,139 +412,381 @@ int ClassTable::check_methods()
   return EXIT_SUCCESS;
 }
 
-int method_class::check_attrs()
+int method_class::check_attrs(SemantContextP ctx)
 {
   return EXIT_SUCCESS;
 }
 
-int attr_class::check_attrs()
+int attr_class::check_attrs(SemantContextP ctx)
 {
-  if (curr_class->get_parent() != No_class) {
-    if (curr_classtable->lookup_attr(curr_class->get_parent(), name)) {
-      ERROR("Attribute " << name << "redefined in class " << curr_class->get_name());
+  Class_ class_ = ctx->get_class();
+  if (class_->get_parent() != No_class) {
+    int parent_id = ctx->lookup_id(class_->get_parent());
+    if (parent_id != -1 && ctx->get_classtable()->get_attr_slot(parent_id, name) != -1) {
+      ERROR("Attribute " << name << "redefined in class " << class_->get_name());
       return EXIT_FAILURE;
     }
   }
   return EXIT_SUCCESS;
 }
 
-int class__class::check_attrs()
+int class__class::check_attrs(SemantContextP ctx)
 {
-  curr_class = this;
-  for (int i = features->first(); features->more(i); i = features->next(i)) {
-    if (features->nth(i)->check_attrs()) {
+  ctx->set_class(this);
+  for (std::vector<Feature>::iterator it = feature_list.begin(); it != feature_list.end(); it++) {
+    if ((*it)->check_attrs(ctx)) {
       return EXIT_FAILURE;
     }
   }
   return EXIT_SUCCESS;
 }
 
-int ClassTable::check_attrs()
+int ClassTable::check_attrs(SemantContextP ctx)
 {
-  SymbolTable<Symbol, Symbol> *object_table;
-  Class_ class_;
-
-  for (std::map<Symbol, Class_>::iterator it = class_table->begin(); it != class_table->end(); it++) {
-    class_ = it->second;
-    if (class_->check_attrs()) {
+  for (size_t id = shared_classes; id < class_table->size(); id++) {
+    if ((*class_table)[id]->check_attrs(ctx)) {
       return EXIT_FAILURE;
     }
   }
   return EXIT_SUCCESS;
 }
 
-int ClassTable::check_parents()
+int ClassTable::check_parents(SemantContextP ctx)
 {
-  for (std::map<Symbol, Class_>::iterator it = class_table->begin(); it != class_table->end(); it++) {
-    curr_class = it->second;
-    if (curr_class->get_parent() == Int || curr_class->get_parent() == Str || curr_class->get_parent() == Bool) {
-      ERROR("Class " << curr_class->get_name() << " has illegal parent Class of Int, String or Bool");
+  for (size_t id = shared_classes; id < class_table->size(); id++) {
+    Class_ class_ = (*class_table)[id];
+    ctx->set_class(class_);
+    if (class_->get_parent() == Int || class_->get_parent() == Str || class_->get_parent() == Bool) {
+      ERROR("Class " << class_->get_name() << " has illegal parent Class of Int, String or Bool");
       return EXIT_FAILURE;
     }
   }
   return EXIT_SUCCESS;
 }
 
-int ClassTable::check_main()
+int ClassTable::check_main(SemantContextP ctx)
 {
-  std::map<Symbol, Class_>::iterator it = class_table->find(Main);
-  if (it == class_table->end()) {
-    semant_error();
-    cerr << "Class Main is not defined." << endl;
+  if (class_index->find(Main) == -1) {
+    ctx->semant_error() << "Class Main is not defined." << endl;
     return EXIT_FAILURE;
   }
   return EXIT_SUCCESS;
 }
 
-int ClassTable::check_cycle()
+/*
+ * One iterative sweep from Object numbers every class it reaches (pre/post,
+ * depth, preorder).  Classes it cannot reach hang off an inheritance cycle;
+ * following their parent links colours each chain with the class it started
+ * from, and meeting the current colour again closes a new cycle.  Each cycle
+ * is reported once, under its first member in install order.
+ */
+int ClassTable::check_cycle(SemantContextP ctx)
 {
-  std::map<Symbol, Class_>::iterator it = class_table->find(Object);
-  Class_ object_class;
+  int count = class_table->size();
 
-  assert(it != class_table->end());
-  object_class = it->second;
-  if (object_class->check_cycle()) {
-    return EXIT_FAILURE;
+  assert(object_id != -1);
+  number_tree_from(object_id);
+  if ((int) preorder->size() == count) {
+    return EXIT_SUCCESS;
   }
 
-  /* Check for classes left outside Object-rooted inheritance tree i.e. C -> B and B -> C */
-  for (std::map<Symbol, Class_>::iterator it = class_table->begin(); it != class_table->end(); it++) {
-    curr_class = it->second;
-    if (curr_class->get_marked() == false) {
-      ERROR("Class inheritance cycle has been detected for class " << curr_class->get_name());
-      return EXIT_FAILURE;
+  std::vector<int> colour(count, -1);
+  std::vector<int> cycles;
+  for (int id = 0; id < count; id++) {
+    if ((*pre)[id] != -1 || colour[id] != -1) {
+      continue;
+    }
+    int walk = id;
+    while (walk != -1 && colour[walk] == -1 && (*pre)[walk] == -1) {
+      colour[walk] = id;
+      walk = (*parent_ids)[walk];
+    }
+    if (walk == -1 || colour[walk] != id) {
+      continue;
+    }
+    /* walk is on a new cycle; name it after its earliest installed member */
+    int first = walk;
+    for (int member = (*parent_ids)[walk]; member != walk; member = (*parent_ids)[member]) {
+      first = std::min(first, member);
+    }
+    cycles.push_back(first);
+  }
+
+  std::sort(cycles.begin(), cycles.end());
+  for (std::vector<int>::iterator it = cycles.begin(); it != cycles.end(); it++) {
+    Class_ class_ = (*class_table)[*it];
+    ctx->set_class(class_);
+    ERROR("Class inheritance cycle has been detected for class " << class_->get_name());
+  }
+  return EXIT_FAILURE;
+}
+
+/* Assign DFS pre/post numbers so that subtypes nest inside their ancestors' intervals */
+void ClassTable::number_tree_from(int root)
+{
+  int count = class_table->size();
+  int counter = 0;
+  std::vector<int> stack, next_child;
+
+  pre->assign(count, -1);
+  post->assign(count, -1);
+  depth->assign(count, 0);
+  preorder->clear();
+  next_child.assign(child_start->begin(), child_start->end() - 1);
+
+  (*pre)[root] = counter++;
+  preorder->push_back(root);
+  stack.push_back(root);
+  while (!stack.empty()) {
+    int id = stack.back();
+    if (next_child[id] == (*child_start)[id + 1]) {
+      (*post)[id] = counter++;
+      stack.pop_back();
+      continue;
+    }
+    int child = (*child_list)[next_child[id]++];
+    (*pre)[child] = counter++;
+    (*depth)[child] = (*depth)[id] + 1;
+    preorder->push_back(child);
+    stack.push_back(child);
+  }
+}
+
+/* Numbering happened in check_cycle; build the lifting table from it */
+int ClassTable::number_tree()
+{
+  int count = class_table->size();
+  int max_depth = 0;
+
+  /* ancestor(id, k) is the 2^k-th ancestor, so any ancestor is reachable in O(log depth) hops */
+  for (int id = 0; id < count; id++) {
+    max_depth = std::max(max_depth, (*depth)[id]);
+  }
+  for (ancestor_levels = 1; (1 << ancestor_levels) <= max_depth; ancestor_levels++)
+    ;
+  ancestors->assign(count * ancestor_levels, -1);
+  for (ArenaVector<int>::iterator it = preorder->begin(); it != preorder->end(); it++) {
+    int anc = (*parent_ids)[*it];
+    for (int k = 0; k < ancestor_levels && anc != -1; k++) {
+      (*ancestors)[*it * ancestor_levels + k] = anc;
+      anc = ancestor(anc, k);
     }
   }
   return EXIT_SUCCESS;
 }
 
-int ClassTable::install_class(Symbol name, Class_ class_)
+/*
+ * Index in slots of the nearest definition at or above class id, or -1.  The
+ * last definition at or before id in preorder is that one or lies in a sibling
+ * subtree, and from there the enclosing definitions lead up to it.
+ */
+int ClassTable::find_slot(ArenaVector<FeatureSlot> &slots, int id)
+{
+  int low = 0;
+  int high = slots.size();
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if ((*pre)[slots[mid].class_id] <= (*pre)[id]) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  int i = low - 1;
+  while (i != -1 && !is_subclass(id, slots[i].class_id)) {
+    i = slots[i].enclosing;
+  }
+  return i;
+}
+
+/*
+ * Preorder visits every parent before its children.  Each class records only
+ * the methods it defines: an override reuses its ancestor's slot, and new
+ * methods follow the inherited slots in declaration order.
+ */
+int ClassTable::build_dispatch_tables()
+{
+  dispatch_sizes->assign(class_table->size(), 0);
+  for (ArenaVector<int>::iterator it = preorder->begin(); it != preorder->end(); it++) {
+    int parent_id = (*parent_ids)[*it];
+    int size = parent_id == -1 ? 0 : (*dispatch_sizes)[parent_id];
+    std::vector<Feature> *features = (*class_table)[*it]->get_feature_list();
+    for (std::vector<Feature>::iterator feature = features->begin(); feature != features->end(); feature++) {
+      if (!(*feature)->is_method()) {
+        continue;
+      }
+      ArenaVector<FeatureSlot> &slots = (*method_slots)[(*feature)->get_name()];
+      FeatureSlot slot = { *it, *feature, -1, -1 };
+      if (parent_id != -1) {
+        slot.enclosing = find_slot(slots, parent_id);
+      }
+      slot.slot = slot.enclosing == -1 ? size++ : slots[slot.enclosing].slot;
+      slots.push_back(slot);
+    }
+    (*dispatch_sizes)[*it] = size;
+  }
+  return EXIT_SUCCESS;
+}
+
+/* The nearest definition of a method at or above a class, or NULL */
+Feature ClassTable::get_method(int id, Symbol method_name)
+{
+  SlotTable::iterator it = method_slots->find(method_name);
+  if (it == method_slots->end()) {
+    return NULL;
+  }
+  int i = find_slot(it->second, id);
+  return i == -1 ? NULL : it->second[i].feature;
+}
+
+/* Dispatch table slot of a method, or -1 if the class has no such method */
+int ClassTable::get_method_slot(int id, Symbol method_name)
+{
+  SlotTable::iterator it = method_slots->find(method_name);
+  if (it == method_slots->end()) {
+    return -1;
+  }
+  int i = find_slot(it->second, id);
+  return i == -1 ? -1 : it->second[i].slot;
+}
+
+/*
+ * Inherited attributes keep their ancestors' slots and each class's own
+ * attributes follow in declaration order, so a class records only those.
+ */
+int ClassTable::build_attr_layouts()
+{
+  attr_counts->assign(class_table->size(), 0);
+  for (ArenaVector<int>::iterator it = preorder->begin(); it != preorder->end(); it++) {
+    int parent_id = (*parent_ids)[*it];
+    int count = parent_id == -1 ? 0 : (*attr_counts)[parent_id];
+    std::vector<Feature> *features = (*class_table)[*it]->get_feature_list();
+    for (std::vector<Feature>::iterator feature = features->begin(); feature != features->end(); feature++) {
+      if ((*feature)->is_method()) {
+        continue;
+      }
+      ArenaVector<FeatureSlot> &slots = (*attr_slots)[(*feature)->get_name()];
+      FeatureSlot slot = { *it, *feature, count++, -1 };
+      if (parent_id != -1) {
+        slot.enclosing = find_slot(slots, parent_id);
+      }
+      slots.push_back(slot);
+    }
+    (*attr_counts)[*it] = count;
+  }
+  return EXIT_SUCCESS;
+}
+
+/* The nearest declaration of an attribute at or above a class, or NULL */
+Feature ClassTable::get_attr(int id, Symbol attr_name)
+{
+  SlotTable::iterator it = attr_slots->find(attr_name);
+  if (it == attr_slots->end()) {
+    return NULL;
+  }
+  int i = find_slot(it->second, id);
+  return i == -1 ? NULL : it->second[i].feature;
+}
+
+/* Layout slot of an attribute, or -1 if the class has no such attribute */
+int ClassTable::get_attr_slot(int id, Symbol attr_name)
+{
+  SlotTable::iterator it = attr_slots->find(attr_name);
+  if (it == attr_slots->end()) {
+    return -1;
+  }
+  int i = find_slot(it->second, id);
+  return i == -1 ? -1 : it->second[i].slot;
+}
+
+/* Object size in words, header included, or -1 if there is no such class */
+int ClassTable::object_size(Symbol class_name)
+{
+  int id = class_index->find(class_name);
+  return id == -1 ? -1 : OBJECT_HEADER_WORDS + (*attr_counts)[id];
+}
+
+/* Word offset of an attribute from the start of the object, or -1 if there is none */
+int ClassTable::attr_offset(Symbol class_name, Symbol attr_name)
+{
+  int id = class_index->find(class_name);
+  int slot = id == -1 ? -1 : get_attr_slot(id, attr_name);
+  return slot == -1 ? -1 : OBJECT_HEADER_WORDS + slot;
+}
+
+int ClassTable::install_class(SemantContextP ctx, Symbol name, Class_ class_)
 {
-  if (class_table->find(name) != class_table->end()) {
-    semant_error(class_);
-    cerr << "Class " << name << " already exists" << endl;
+  if (class_index->find(name) != -1) {
+    ctx->semant_error(class_) << "Class " << name << " already exists" << endl;
     return EXIT_FAILURE;
   }
   if (name == SELF_TYPE) {
-    semant_error(class_);
-    cerr << "Class cannot have name SELF_TYPE" << endl;
+    ctx->semant_error(class_) << "Class cannot have name SELF_TYPE" << endl;
     return EXIT_FAILURE;
   }
-  class_table->insert(std::pair<Symbol, Class_>(name, class_));
+  if (name == Object) {
+    object_id = class_table->size();
+  }
+  class_->install_tables(arena);
+  class_index->insert(name, class_table->size());
+  class_table->push_back(class_);
   return EXIT_SUCCESS;
 }
 
-Class_ ClassTable::lookup_class(Symbol class_name)
+/* Dense id of a class, or -1 after reporting that it does not exist */
+int SemantContext::lookup_id(Symbol class_name)
 {
   if (class_name == SELF_TYPE) {
     class_name = curr_class->get_name();
   }
-  std::map<Symbol, Class_>::iterator it = class_table->find(class_name);
-  if (it == class_table->end()) {
-    ERROR("Type " << class_name << " does not exist");
-    it = class_table->find(Object);
-    assert(it != class_table->end());
+  int id = classtable->find_id(class_name);
+  if (id == -1) {
+    semant_error(curr_class) << "Type " << class_name << " does not exist" << endl;
   }
-  return it->second;
+  return id;
 }
 
-Symbol ClassTable::lookup_attr(Symbol class_name, Symbol var_name)
+Class_ SemantContext::lookup_class(Symbol class_name)
 {
-  Class_ class_ = lookup_class(class_name);
-  return class_->get_attr(var_name);
+  COUNT(lookup_class);
+  int id = lookup_id(class_name);
+  return classtable->get_class(id == -1 ? classtable->get_object_id() : id);
 }
 
-Feature ClassTable::lookup_method(Symbol class_name, Symbol method_name)
+Symbol SemantContext::lookup_attr(Symbol class_name, Symbol var_name)
+{
+  COUNT(lookup_class);
+  int id = lookup_id(class_name);
+  if (id == -1) {
+    id = classtable->get_object_id();
+  }
+  COUNT(get_attr);
+  Symbol type_decl = classtable->get_class(id)->get_object_table()->lookup(var_name);
+  if (type_decl == NULL) {
+    /* Not a local or an own attribute, so it can only be inherited */
+    Feature attr = classtable->get_attr(id, var_name);
+    return attr == NULL ? NULL : attr->get_type_decl();
+  }
+  return type_decl;
+}
+
+Feature SemantContext::lookup_method(Symbol class_name, Symbol method_name)
 {
   if (class_name == No_type) {
     class_name = curr_class->get_name();
   }
-  Class_ class_ = lookup_class(class_name);
-  return class_->get_method(method_name);
+  COUNT(lookup_class);
+  int id = lookup_id(class_name);
+  if (id == -1) {
+    id = classtable->get_object_id();
+  }
+  COUNT(get_method);
+  return classtable->get_method(id, method_name);
 }
 
-bool ClassTable::leq(Symbol class1, Symbol class2)
+bool SemantContext::leq(Symbol class1, Symbol class2)
 {
+  COUNT(leq);
   if (class1 == No_type || class2 == No_type) {
     return true;
   }
@@ -333,17 +805,49 @@ bool ClassTable::leq(Symbol class1, Symbol class2)
     return true;
   }
 
-  Class_ class1_ = lookup_class(class1);
-  Class_ class2_ = lookup_class(class2);
+  int id1 = lookup_id(class1);
+  int id2 = lookup_id(class2);
 
-  if (class1_->get_parent() != No_class) {
-    return leq(class1_->get_parent(), class2);
+  if (id1 == -1 || id2 == -1) {
+    /* Undefined type, already reported by lookup_id */
+    return false;
   }
-  return false;
+  /* class1 inherits from class2 iff its interval nests inside class2's */
+  return classtable->is_subclass(id1, id2);
 }
 
-Symbol ClassTable::lub(Symbol class1, Symbol class2)
+/* Lowest common ancestor by binary lifting over the ancestor table built in number_tree */
+int ClassTable::lca(int id1, int id2)
 {
+  if (is_subclass(id1, id2)) {
+    return id2;
+  }
+  if (is_subclass(id2, id1)) {
+    return id1;
+  }
+
+  if ((*depth)[id1] < (*depth)[id2]) {
+    std::swap(id1, id2);
+  }
+  for (int k = 0, diff = (*depth)[id1] - (*depth)[id2]; diff; k++, diff >>= 1) {
+    if (diff & 1) {
+      id1 = ancestor(id1, k);
+    }
+  }
+  for (int k = ancestor_levels - 1; k >= 0; k--) {
+    int anc1 = ancestor(id1, k);
+    int anc2 = ancestor(id2, k);
+    if (anc1 != anc2) {
+      id1 = anc1;
+      id2 = anc2;
+    }
+  }
+  return ancestor(id1, 0);
+}
+
+Symbol SemantContext::lub(Symbol class1, Symbol class2)
+{
+  COUNT(lub);
   if (class1 == SELF_TYPE) {
     class1 = curr_class->get_name();
   }
@@ -351,116 +855,100 @@ Symbol ClassTable::lub(Symbol class1, Symbol class2)
     class2 = curr_class->get_name();
   }
 
-  if (leq(class1, class2)) {
+  if (class1 == No_type || class2 == No_type || class1 == class2) {
     return class2;
-  } else if (leq(class2, class1)) {
-    return class1;
   }
-
-  Class_ class1_ = lookup_class(class1);
-  if (class1_->get_parent() != No_class) {
-    return lub(class1_->get_parent(), class2);
+  int id1 = lookup_id(class1);
+  int id2 = lookup_id(class2);
+  if (id1 == -1 || id2 == -1) {
+    return Object;
   }
-  return Object;
+  return classtable->get_class(classtable->lca(id1, id2))->get_name();
 }
 
-void ClassTable::check_and_add_to_object_table(Symbol name, Symbol type_decl)
-{
-  lookup_class(type_decl);
-  add_to_object_table(name, type_decl);
-}
-
-int ClassTable::add_to_object_table(Symbol name, Symbol type_decl)
+/*
+ * Least upper bound of all types at once, e.g. the branches of a case.  The LCA of a
+ * set of classes is the LCA of its first and last members in DFS preorder.  No_type is
+ * handled as if the pairwise lub were folded left to right over the list.
+ */
+Symbol SemantContext::lub(std::vector<Symbol> &types)
 {
-  SymbolTable<Symbol, Symbol> *object_table = curr_class->get_object_table();
+  COUNT(lub);
+  int first = -1, last = -1;
+  size_t start = 0;
 
-  if (object_table->probe(name)) {
-    ERROR("Duplicate variable " << name << " exists in same scope");
-    return EXIT_FAILURE;
+  if (types.empty()) {
+    return No_type;
   }
-  if (name == self) {
-    ERROR("Variable cannot have name self");
-    return EXIT_FAILURE;
+  for (size_t i = 0; i < types.size(); i++) {
+    if (types[i] == No_type) {
+      start = i + 1;
+    }
   }
-  object_table->addid(name, new Symbol(type_decl));
-  return EXIT_SUCCESS;
-}
-
-Symbol class__class::get_attr(Symbol var)
-{
-  Symbol *type_decl = object_table->lookup(var);
-  if (type_decl == NULL) {
-    if (get_parent() != No_class) {
-      Class_ parent_class = curr_classtable->lookup_class(get_parent());
-      return parent_class->get_attr(var);
-    } else {
-      return NULL;
+  if (start == types.size()) {
+    return No_type;
+  }
+  if (start == types.size() - 1) {
+    return types[start];
+  }
+  for (size_t i = start; i < types.size(); i++) {
+    int id = lookup_id(types[i]);
+    if (id == -1) {
+      id = classtable->get_object_id();
+    }
+    if (first == -1 || classtable->get_pre(id) < classtable->get_pre(first)) {
+      first = id;
+    }
+    if (last == -1 || classtable->get_pre(id) > classtable->get_pre(last)) {
+      last = id;
     }
   }
-  return *type_decl;
+  return classtable->get_class(classtable->lca(first, last))->get_name();
 }
 
-Feature class__class::get_method(Symbol method)
+void SemantContext::check_and_add_to_object_table(Symbol name, Symbol type_decl)
 {
-  std::map<Symbol, Feature>::iterator it = method_table->find(method);
-  if (it == method_table->end()) {
-    if (get_parent() != No_class) {
-      Class_ parent_class = curr_classtable->lookup_class(get_parent());
-      return parent_class->get_method(method);
-    } else {
-      return NULL;
-    }
-  }
-  return it->second;
+  lookup_class(type_decl);
+  add_to_object_table(name, type_decl);
 }
 
-int class__class::check_cycle()
+int SemantContext::add_to_object_table(Symbol name, Symbol type_decl)
 {
-  Class_ class_;
+  ScopedEnv *object_table = curr_class->get_object_table();
 
-  if (marked) {
-    /* This node has already been marked, meaning there's a cycle */
-    curr_classtable->semant_error(this);
-    cerr << "Class inheritance cycle has been detected for class " << name << endl;
+  if (object_table->probe(name)) {
+    semant_error(curr_class) << "Duplicate variable " << name << " exists in same scope" << endl;
     return EXIT_FAILURE;
   }
-  marked = true;
-
-  for (std::list<Class_>::iterator it = children->begin(); it != children->end(); it++) {
-    class_ = *it;
-    if (class_->check_cycle()) {
-      return EXIT_FAILURE;
-    };
+  if (name == self) {
+    semant_error(curr_class) << "Variable cannot have name self" << endl;
+    return EXIT_FAILURE;
   }
+  object_table->addid(name, type_decl);
   return EXIT_SUCCESS;
 }
 
-void class__class::add_child(Class_ class_)
+int class__class::get_environment(SemantContextP ctx)
 {
-  children->push_back(class_);
-}
-
-int class__class::get_environment()
-{
-  curr_class = this;
-  for(int i = features->first(); features->more(i); i = features->next(i)) {
-    if (features->nth(i)->get_environment()) {
+  ctx->set_class(this);
+  for (std::vector<Feature>::iterator it = feature_list.begin(); it != feature_list.end(); it++) {
+    if ((*it)->get_environment(ctx)) {
       return EXIT_FAILURE;
     }
   }
   return EXIT_SUCCESS;
 }
 
-int attr_class::get_environment()
+int attr_class::get_environment(SemantContextP ctx)
 {
-  return curr_classtable->add_to_object_table(name, type_decl);
+  return ctx->add_to_object_table(name, type_decl);
 }
 
-int method_class::get_environment()
+int method_class::get_environment(SemantContextP ctx)
 {
-  std::map<Symbol, Feature> *method_table = curr_class->get_method_table();
+  MethodTable *method_table = ctx->get_class()->get_method_table();
   if (method_table->find(name) != method_table->end()) {
-    ERROR("Class " << curr_class << " has duplicate method " << name);
+    ERROR("Class " << ctx->get_class() << " has duplicate method " << name);
     return EXIT_FAILURE;
   }
   if (name == self) {
@@ -468,14 +956,51 @@ int method_class::get_environment()
     return EXIT_FAILURE;
   }
   method_table->insert(std::pair<Symbol, Feature>(name, this));
+  signature = MethodSignature::intern(ctx, this);
   return EXIT_SUCCESS;
 }
 
-void ClassTable::install_basic_classes() {
+/*
+ * The basic classes are built once per process and taken through the
+ * environment, tree and table passes by a throwaway analysis whose arena is
+ * never released.  Every ClassTable then installs those same nodes at ids
+ * 0 .. BASIC_CLASSES - 1; nothing may modify them afterwards, so the
+ * per-analysis passes start after them.
+ */
+static std::vector<Class_> *prelude;
+static std::once_flag prelude_built;
+
+void ClassTable::build_prelude()
+{
+  Arena *arena = new Arena();
+  ClassTableP classtable = arena->make<ClassTable>(arena);
+  SemantContextP ctx = arena->make<SemantContext>(classtable, arena);
+
+  classtable->build_basic_classes(ctx);
+  classtable->get_environment(ctx);
+  classtable->generate_tree(ctx);
+  classtable->check_cycle(ctx);
+  assert(ctx->errors() == 0 && (int) classtable->class_table->size() == BASIC_CLASSES);
+  prelude = new std::vector<Class_>(classtable->class_table->begin(), classtable->class_table->end());
+  prelude_signatures = ctx->get_signatures();
+}
+
+void ClassTable::install_basic_classes()
+{
+  std::call_once(prelude_built, &ClassTable::build_prelude);
+  for (std::vector<Class_>::iterator it = prelude->begin(); it != prelude->end(); it++) {
+    class_index->insert((*it)->get_name(), class_table->size());
+    class_table->push_back(*it);
+  }
+  object_id = class_index->find(Object);
+  shared_classes = class_table->size();
+}
+
+void ClassTable::build_basic_classes(SemantContextP ctx) {
 
     // The tree package uses these globals to annotate the classes built below.
    // curr_lineno  = 0;
-    Symbol filename = stringtable.add_string("<basic class>");
+    Symbol filename = basic_filename;
     
     // The following demonstrates how to create dummy parse trees to
     // refer to basic Cool classes.  There's no need for method
@@ -571,11 +1096,11 @@ void ClassTable::install_basic_classes() {
 						      no_expr()))),
 	       filename);
 
-    install_class(Object, Object_class);
-    install_class(IO, IO_class);
-    install_class(Bool, Bool_class);
-    install_class(Int, Int_class);
-    install_class(Str, Str_class);
+    install_class(ctx, Object, Object_class);
+    install_class(ctx, IO, IO_class);
+    install_class(ctx, Bool, Bool_class);
+    install_class(ctx, Int, Int_class);
+    install_class(ctx, Str, Str_class);
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -583,262 +1108,633 @@ void ClassTable::install_basic_classes() {
 // semant_error is an overloaded function for reporting errors
 // during semantic analysis.  There are three versions:
 //
-//    ostream& ClassTable::semant_error()                
+//    ostream& SemantContext::semant_error()                
 //
-//    ostream& ClassTable::semant_error(Class_ c)
+//    ostream& SemantContext::semant_error(Class_ c)
 //       print line number and filename for `c'
 //
-//    ostream& ClassTable::semant_error(Symbol filename, tree_node *t)  
+//    ostream& SemantContext::semant_error(Symbol filename, tree_node *t)  
 //       print a line number and filename
 //
+// Each call starts a new diagnostic; the text written to the returned
+// stream becomes its message.
+//
 ///////////////////////////////////////////////////////////////////
 
-ostream& ClassTable::semant_error(Class_ c)
+SemantContext::SemantContext(ClassTableP classtable, Arena *arena) :
+  classtable(classtable), curr_class(NULL), semant_errors(0), arena(arena)
+{
+  diagnostics = arena->make<std::vector<SemantDiagnostic> >();
+  message = arena->make<std::ostringstream>();
+  frames = arena->make<ArenaVector<SemantFrame> >(arena);
+  phase_times = arena->make<std::vector<SemantPhaseTime> >();
+  signatures = arena->make<SignatureTable>(arena);
+  memset(&counters, 0, sizeof(counters));
+}
+
+void SemantContext::enterscope()
+{
+  COUNT(scopes);
+  curr_class->get_object_table()->enterscope();
+}
+
+void SemantContext::exitscope()
+{
+  curr_class->get_object_table()->exitscope();
+}
+
+void SemantContext::record_phase(const char *phase, double seconds)
+{
+  SemantPhaseTime time = { phase, seconds };
+  phase_times->push_back(time);
+}
+
+/* Move the text written since the last semant_error into its diagnostic */
+void SemantContext::finish_diagnostic()
+{
+  if (diagnostics->empty()) {
+    return;
+  }
+  std::string text = message->str();
+  if (!text.empty() && text[text.size() - 1] == '\n') {
+    text.erase(text.size() - 1);
+  }
+  diagnostics->back().message += text;
+  message->str("");
+}
+
+/* A direct call to one node kind's rule, which the compiler can inline */
+template <class Node> static inline Expression step_as(SemantContextP ctx, Expression expr, int &state)
+{
+  return static_cast<Node *>(expr)->Node::semant_step(ctx, state);
+}
+
+static Expression step_tagged(SemantContextP ctx, Expression expr, int &state)
+{
+  switch (expr->get_kind()) {
+  case EXPR_ASSIGN:          return step_as<assign_class>(ctx, expr, state);
+  case EXPR_STATIC_DISPATCH: return step_as<static_dispatch_class>(ctx, expr, state);
+  case EXPR_DISPATCH:        return step_as<dispatch_class>(ctx, expr, state);
+  case EXPR_COND:            return step_as<cond_class>(ctx, expr, state);
+  case EXPR_LOOP:            return step_as<loop_class>(ctx, expr, state);
+  case EXPR_TYPCASE:         return step_as<typcase_class>(ctx, expr, state);
+  case EXPR_BLOCK:           return step_as<block_class>(ctx, expr, state);
+  case EXPR_LET:             return step_as<let_class>(ctx, expr, state);
+  case EXPR_PLUS:            return step_as<plus_class>(ctx, expr, state);
+  case EXPR_SUB:             return step_as<sub_class>(ctx, expr, state);
+  case EXPR_MUL:             return step_as<mul_class>(ctx, expr, state);
+  case EXPR_DIVIDE:          return step_as<divide_class>(ctx, expr, state);
+  case EXPR_NEG:             return step_as<neg_class>(ctx, expr, state);
+  case EXPR_LT:              return step_as<lt_class>(ctx, expr, state);
+  case EXPR_EQ:              return step_as<eq_class>(ctx, expr, state);
+  case EXPR_LEQ:             return step_as<leq_class>(ctx, expr, state);
+  case EXPR_COMP:            return step_as<comp_class>(ctx, expr, state);
+  case EXPR_INT_CONST:       return step_as<int_const_class>(ctx, expr, state);
+  case EXPR_BOOL_CONST:      return step_as<bool_const_class>(ctx, expr, state);
+  case EXPR_STRING_CONST:    return step_as<string_const_class>(ctx, expr, state);
+  case EXPR_NEW:             return step_as<new__class>(ctx, expr, state);
+  case EXPR_ISVOID:          return step_as<isvoid_class>(ctx, expr, state);
+  case EXPR_NO_EXPR:         return step_as<no_expr_class>(ctx, expr, state);
+  case EXPR_OBJECT:          return step_as<object_class>(ctx, expr, state);
+  }
+  return expr->semant_step(ctx, state);
+}
+
+/*
+ * Type-checks an expression tree without recursion.  The top frame's node is
+ * stepped until it has no more children to hand out; a child handed out is
+ * pushed and checked completely before its parent is stepped again, so the
+ * order of checks and diagnostics is that of a recursive walk.
+ */
+void SemantContext::check_expression(Expression root)
+{
+  if (semant_tagged) {
+    check_frames<true>(root);
+  } else {
+    check_frames<false>(root);
+  }
+}
+
+template <bool tagged> void SemantContext::check_frames(Expression root)
+{
+  size_t base = frames->size();
+  SemantFrame frame = { root, 0 };
+  frames->push_back(frame);
+  while (frames->size() > base) {
+    SemantFrame &top = frames->back();
+    Expression child = tagged ? step_tagged(this, top.expr, top.state) : top.expr->semant_step(this, top.state);
+    if (child == NULL) {
+      frames->pop_back();
+    } else {
+      SemantFrame next = { child, 0 };
+      frames->push_back(next);
+    }
+  }
+}
+
+void Expression_class::semant(SemantContextP ctx)
+{
+  ctx->check_expression(this);
+}
+
+std::vector<SemantDiagnostic> *SemantContext::get_diagnostics()
+{
+  finish_diagnostic();
+  return diagnostics;
+}
+
+/* Append another context's diagnostics after ours and add up its counts */
+void SemantContext::merge(SemantContextP other)
+{
+  append_diagnostics(other->get_diagnostics());
+  semant_errors += other->errors();
+  counters.leq += other->counters.leq;
+  counters.lub += other->counters.lub;
+  counters.lookup_class += other->counters.lookup_class;
+  counters.get_method += other->counters.get_method;
+  counters.get_attr += other->counters.get_attr;
+  counters.scopes += other->counters.scopes;
+  counters.released_bytes += other->counters.released_bytes;
+}
+
+/* Move the diagnostics reported so far into another vector */
+void SemantContext::take_diagnostics(std::vector<SemantDiagnostic> *into)
+{
+  finish_diagnostic();
+  into->swap(*diagnostics);
+  diagnostics->clear();
+}
+
+void SemantContext::append_diagnostics(std::vector<SemantDiagnostic> *others)
+{
+  finish_diagnostic();
+  diagnostics->insert(diagnostics->end(), others->begin(), others->end());
+}
+
+ostream& SemantContext::semant_error(Class_ c)
 {                                                             
     return semant_error(c->get_filename(),c);
 }    
 
-ostream& ClassTable::semant_error(Symbol filename, tree_node *t)
+ostream& SemantContext::semant_error(Symbol filename, tree_node *t)
 {
-    error_stream << filename << ":" << t->get_line_number() << ": ";
-    return semant_error();
+    ostream& stream = semant_error();
+    diagnostics->back().filename = filename;
+    diagnostics->back().line = t->get_line_number();
+    return stream;
 }
 
-ostream& ClassTable::semant_error()                  
+ostream& SemantContext::semant_error()                  
 {                                                 
+    finish_diagnostic();
+    SemantDiagnostic diagnostic = { NULL, 0, "", false };
+    diagnostics->push_back(diagnostic);
     semant_errors++;                            
-    return error_stream;
+    return *message;
 } 
 
+ostream& SemantContext::semant_warning(Symbol filename, tree_node *t)
+{
+    finish_diagnostic();
+    SemantDiagnostic diagnostic = { filename, t->get_line_number(), "", true };
+    diagnostics->push_back(diagnostic);
+    return *message;
+}
 
-void class__class::semant()
+
+void class__class::semant(SemantContextP ctx)
 {
-  curr_class = this;
-  for(int i = features->first(); features->more(i); i = features->next(i)) {
-    features->nth(i)->semant();
+  ctx->set_class(this);
+  for (std::vector<Feature>::iterator it = feature_list.begin(); it != feature_list.end(); it++) {
+    (*it)->semant(ctx);
+  }
+  if (semant_low_memory) {
+    ctx->get_counters().released_bytes += release_scratch();
   }
 }
 
-void method_class::semant()
+void class__class::install_tables(Arena *arena)
 {
-  SymbolTable<Symbol, Symbol> *object_table = curr_class->get_object_table();
+  /* Low-memory mode frees these early, so they keep their memory on the heap */
+  Arena *tables = semant_low_memory ? NULL : arena;
+  object_table = arena->make<ScopedEnv>(tables);
   object_table->enterscope();
+  method_table = arena->make<MethodTable>(std::less<Symbol>(), tables);
+}
 
-  for(int i = formals->first(); formals->more(i); i = formals->next(i)) {
-    formals->nth(i)->semant();
+void class__class::release_tables()
+{
+  object_table = NULL;
+  method_table = NULL;
+  for (std::vector<Feature>::iterator it = feature_list.begin(); it != feature_list.end(); it++) {
+    (*it)->release_signature();
   }
+}
 
-  expr->semant();
-  if (curr_classtable->leq(expr->get_type(), return_type) == false) {
-    curr_classtable->semant_error(curr_class);
-    cerr << "Method body has type " << expr->get_type() << " but function has type " << return_type << endl;
+/*
+ * Once its bodies are checked, nothing reads a class's object or method
+ * table again: dispatches from other classes resolve through the class
+ * table's method and attribute slots.
+ * Returns roughly how many bytes were freed.
+ */
+size_t class__class::release_scratch()
+{
+  size_t bytes = object_table->release() +
+    method_table->size() * (sizeof(std::pair<const Symbol, Feature>) + 4 * sizeof(void *));
+  MethodTable(std::less<Symbol>(), method_table->get_allocator()).swap(*method_table);
+  return bytes;
+}
+
+/* Number of expression nodes in the class, counted without recursion */
+int class__class::get_weight()
+{
+  std::vector<Expression> stack;
+  int weight = 0;
+  for (std::vector<Feature>::iterator it = feature_list.begin(); it != feature_list.end(); it++) {
+    stack.push_back((*it)->get_expr());
+    while (!stack.empty()) {
+      Expression expr = stack.back();
+      stack.pop_back();
+      weight++;
+      expr->get_children(stack);
+    }
+  }
+  return weight;
+}
+
+void static_dispatch_class::get_children(std::vector<Expression> &children)
+{
+  children.push_back(expr);
+  children.insert(children.end(), actual_list.begin(), actual_list.end());
+}
+
+void dispatch_class::get_children(std::vector<Expression> &children)
+{
+  children.push_back(expr);
+  children.insert(children.end(), actual_list.begin(), actual_list.end());
+}
+
+void typcase_class::get_children(std::vector<Expression> &children)
+{
+  children.push_back(expr);
+  for (std::vector<Case>::iterator it = case_list.begin(); it != case_list.end(); it++) {
+    children.push_back((*it)->get_expr());
   }
-  object_table->exitscope();
 }
 
-void formal_class::semant()
+void block_class::get_children(std::vector<Expression> &children)
+{
+  children.insert(children.end(), body_list.begin(), body_list.end());
+}
+
+void method_class::semant(SemantContextP ctx)
+{
+  ctx->enterscope();
+
+  for (std::vector<Formal>::iterator it = formal_list.begin(); it != formal_list.end(); it++) {
+    (*it)->semant(ctx);
+  }
+
+  expr->semant(ctx);
+  if (ctx->leq(expr->get_type(), return_type) == false) {
+    ctx->semant_error(ctx->get_class()) << "Method body has type " << expr->get_type() << " but function has type " << return_type << endl;
+  }
+  ctx->exitscope();
+}
+
+void formal_class::semant(SemantContextP ctx)
 {
   if (type_decl == SELF_TYPE) {
-    curr_classtable->semant_error(curr_class);
-    cerr << "Formal cannot have type SELF_TYPE" << endl;
+    ctx->semant_error(ctx->get_class()) << "Formal cannot have type SELF_TYPE" << endl;
   }
-  curr_classtable->check_and_add_to_object_table(name, type_decl);
+  ctx->check_and_add_to_object_table(name, type_decl);
 }
 
-void attr_class::semant()
+void attr_class::semant(SemantContextP ctx)
 {
-  init->semant();
-  if (curr_classtable->leq(init->get_type(), type_decl) == false) {
-    curr_classtable->semant_error(curr_class);
-    cerr << "Initialization has type " << init->get_type() << " but attribute has type " << type_decl << endl;
+  init->semant(ctx);
+  if (ctx->leq(init->get_type(), type_decl) == false) {
+    ctx->semant_error(ctx->get_class()) << "Initialization has type " << init->get_type() << " but attribute has type " << type_decl << endl;
   }
 }
 
-void assign_class::semant()
+Expression assign_class::semant_step(SemantContextP ctx, int &state)
 {
-  Symbol type_decl = curr_classtable->lookup_attr(curr_class->get_name(), name);
-  expr->semant();
+  if (state++ == 0) {
+    return expr;
+  }
+  Symbol type_decl = ctx->lookup_attr(ctx->get_class()->get_name(), name);
   if (!type_decl) {
     SEMANT_ERROR("Variable " << name << " does not exist in this scope");
   } else {
-    if (curr_classtable->leq(expr->get_type(), type_decl)) {
+    if (ctx->leq(expr->get_type(), type_decl)) {
       type = expr->get_type();
     } else {
       SEMANT_ERROR("Expression type " << expr->get_type() << " does not inherit from " << type_decl);
     }
   }
+  return NULL;
 }
 
 int method_class::get_arg_len()
 {
-  return formals->len();
+  return formal_list.size();
 }
 
 Symbol method_class::get_arg_type(int i)
 {
   assert(i < get_arg_len());
-  return formals->nth(i)->get_type_decl();
+  return formal_list[i]->get_type_decl();
 }
 
-Symbol dispatch_common(Expression expr, Symbol type_name, Symbol name, Expressions actual, Feature method)
+/*
+ * Checks the actuals of a dispatch to method one at a time.  state is 2 + i
+ * once actual i has been handed out; NULL means the dispatch is done and
+ * type holds its result.
+ */
+static Expression dispatch_common(SemantContextP ctx, int &state, Expression expr, Symbol type_name, Symbol name, std::vector<Expression> *actual, Feature method, Symbol &type)
 {
-  if (method == NULL) {
-    ERROR("No method " << name << " in class " << type_name << " found");
-    return Object;
-  } else if (method->get_arg_len() != actual->len()) {
-    ERROR("Method " << method->get_name() << " only has " << method->get_arg_len() << " arguments");
-    return Object;
-  }
-  for(int i = actual->first(); actual->more(i); i = actual->next(i)) {
-    actual->nth(i)->semant();
-    if (method == NULL || i >= method->get_arg_len()) {
-      /* Number of arguments is different, error should've been caught above */
-      continue;
+  if (state == 2) {
+    if (method == NULL) {
+      ERROR("No method " << name << " in class " << type_name << " found");
+      type = Object;
+      return NULL;
+    } else if (method->get_arg_len() != (int) actual->size()) {
+      ERROR("Method " << method->get_name() << " only has " << method->get_arg_len() << " arguments");
+      type = Object;
+      return NULL;
     }
-    if (curr_classtable->leq(actual->nth(i)->get_type(), method->get_arg_type(i)) == false) {
+  } else {
+    int i = state - 3;
+    if (ctx->leq((*actual)[i]->get_type(), method->get_arg_type(i)) == false) {
       ERROR("Method " << method->get_name() << " argument " << i + 1<< " has type " << method->get_arg_type(i));
-      return Object;
+      type = Object;
+      return NULL;
     }
   }
-  Symbol type = method->get_return_type();
+  int next = state - 2;
+  if (next < (int) actual->size()) {
+    state++;
+    return (*actual)[next];
+  }
+  type = method->get_return_type();
   if (type == SELF_TYPE) {
     type = expr->get_type();
   }
-  curr_classtable->lookup_class(type);
-  return type;
+  ctx->lookup_class(type);
+  return NULL;
 }
 
-void static_dispatch_class::semant()
+Expression static_dispatch_class::semant_step(SemantContextP ctx, int &state)
 {
-  expr->semant();
-  if (curr_classtable->leq(expr->get_type(), type_name)) {
-    Feature method = curr_classtable->lookup_method(type_name, name);
-    type = dispatch_common(expr, type_name, name, actual, method);
-  } else {
-    SEMANT_ERROR("Expression of type " << expr->get_type() << " does not inherit from static dispatch type name " << type_name);
+  switch (state) {
+  case 0:
+    state = 1;
+    return expr;
+  case 1:
+    if (!ctx->leq(expr->get_type(), type_name)) {
+      SEMANT_ERROR("Expression of type " << expr->get_type() << " does not inherit from static dispatch type name " << type_name);
+      return NULL;
+    }
+    target = ctx->lookup_method(type_name, name);
+    state = 2;
   }
+  return dispatch_common(ctx, state, expr, type_name, name, &actual_list, target, type);
 }
 
-void dispatch_class::semant()
+Expression dispatch_class::semant_step(SemantContextP ctx, int &state)
 {
-  expr->semant();
-  Feature method = curr_classtable->lookup_method(expr->get_type(), name);
-  type = dispatch_common(expr, expr->get_type(), name, actual, method);
+  switch (state) {
+  case 0:
+    state = 1;
+    return expr;
+  case 1:
+    target = ctx->lookup_method(expr->get_type(), name);
+    state = 2;
+  }
+  return dispatch_common(ctx, state, expr, expr->get_type(), name, &actual_list, target, type);
 }
 
-int typcase_class::check_dups()
+/* Reports the first branch whose type occurs again, in two linear passes */
+int typcase_class::check_dups(SemantContextP ctx)
 {
-  for(int i = cases->first(); cases->more(i); i = cases->next(i)) {
-    for(int j = cases->next(i); cases->more(j); j = cases->next(j)) {
-      if (cases->nth(i)->get_type_decl() == cases->nth(j)->get_type_decl()) {
-	ERROR("Branches in case statement have same type " << cases->nth(i)->get_type_decl());
-	return EXIT_FAILURE;
-      }
+  std::unordered_map<Symbol, int> count;
+  for (std::vector<Case>::iterator it = case_list.begin(); it != case_list.end(); it++) {
+    count[(*it)->get_type_decl()]++;
+  }
+  for (std::vector<Case>::iterator it = case_list.begin(); it != case_list.end(); it++) {
+    if (count[(*it)->get_type_decl()] > 1) {
+      ERROR("Branches in case statement have same type " << (*it)->get_type_decl());
+      return EXIT_FAILURE;
     }
   }
   return EXIT_SUCCESS;
 }
 
-void typcase_class::semant()
+/*
+ * A case takes the branch whose type is the closest ancestor of the value's
+ * class.  A branch whose type lies below the static type S of the scrutinee
+ * can always be taken; of the branches above S only the nearest one can, and
+ * a branch unrelated to S never can.
+ */
+void typcase_class::check_reachable(SemantContextP ctx)
 {
-  expr->semant();
+  ClassTableP classtable = ctx->get_classtable();
+  Symbol static_type = expr->get_type() == SELF_TYPE ? ctx->get_class()->get_name() : expr->get_type();
+  int s = classtable->find_id(static_type);
+  if (s == -1) {
+    return;
+  }
 
-  for(int i = cases->first(); cases->more(i); i = cases->next(i)) {
-    cases->nth(i)->semant();
-    if (i == cases->first()) {
-      type = cases->nth(i)->get_expr()->get_type();
-    } else {
-      type = curr_classtable->lub(type, cases->nth(i)->get_expr()->get_type());
+  std::vector<int> ids;
+  int nearest = -1;
+  for (std::vector<Case>::iterator it = case_list.begin(); it != case_list.end(); it++) {
+    int t = classtable->find_id((*it)->get_type_decl());
+    ids.push_back(t);
+    if (t != -1 && classtable->is_subclass(s, t) &&
+	(nearest == -1 || classtable->get_depth(t) > classtable->get_depth(nearest))) {
+      nearest = t;
     }
   }
-  if (check_dups()) {
+  for (size_t i = 0; i < case_list.size(); i++) {
+    int t = ids[i];
+    if (t == -1 || t == nearest || classtable->is_subclass(t, s)) {
+      continue;
+    }
+    ctx->semant_warning(ctx->get_class()->get_filename(), case_list[i])
+      << "Branch of type " << case_list[i]->get_type_decl() << " can never be selected" << endl;
+  }
+}
+
+/*
+ * Deeper types first: testing the branches in this order, the first whose
+ * type is an ancestor of the value's class is the one to take.
+ */
+void typcase_class::order_branches(SemantContextP ctx)
+{
+  ClassTableP classtable = ctx->get_classtable();
+  std::vector<std::pair<int, Case> > keyed;
+  for (std::vector<Case>::iterator it = case_list.begin(); it != case_list.end(); it++) {
+    int t = classtable->find_id((*it)->get_type_decl());
+    keyed.push_back(std::make_pair(t == -1 ? 0 : -classtable->get_depth(t), *it));
+  }
+  std::stable_sort(keyed.begin(), keyed.end(),
+		   [](const std::pair<int, Case> &a, const std::pair<int, Case> &b) { return a.first < b.first; });
+  dispatch_order.clear();
+  for (std::vector<std::pair<int, Case> >::iterator it = keyed.begin(); it != keyed.end(); it++) {
+    dispatch_order.push_back(it->second);
+  }
+}
+
+/* state 1 + i hands out branch i, closing the scope of branch i - 1 first */
+Expression typcase_class::semant_step(SemantContextP ctx, int &state)
+{
+  if (state == 0) {
+    state = 1;
+    return expr;
+  }
+  int i = state - 1;
+  if (i > 0) {
+    case_list[i - 1]->exit_scope(ctx);
+  }
+  if (i < (int) case_list.size()) {
+    state++;
+    case_list[i]->enter_scope(ctx);
+    return case_list[i]->get_expr();
+  }
+
+  std::vector<Symbol> types;
+  for (std::vector<Case>::iterator it = case_list.begin(); it != case_list.end(); it++) {
+    types.push_back((*it)->get_expr()->get_type());
+  }
+  type = ctx->lub(types);
+  if (check_dups(ctx)) {
     type = Object;
+    return NULL;
   }
+  if (semant_warnings) {
+    check_reachable(ctx);
+  }
+  order_branches(ctx);
+  return NULL;
 }
 
 
-void cond_class::semant()
+Expression cond_class::semant_step(SemantContextP ctx, int &state)
 {
-  pred->semant();
-  then_exp->semant();
-  else_exp->semant();
+  switch (state++) {
+  case 0:
+    return pred;
+  case 1:
+    return then_exp;
+  case 2:
+    return else_exp;
+  }
   if (pred->get_type() == Bool) {
-    type = curr_classtable->lub(then_exp->get_type(), else_exp->get_type());
+    type = ctx->lub(then_exp->get_type(), else_exp->get_type());
   } else {
     SEMANT_ERROR("Predicate of conditional is not of type Bool");
   }
+  return NULL;
 }
 
-void loop_class::semant()
+Expression loop_class::semant_step(SemantContextP ctx, int &state)
 {
-  pred->semant();
-  body->semant();
+  switch (state++) {
+  case 0:
+    return pred;
+  case 1:
+    return body;
+  }
   if (pred->get_type() != Bool) {
     SEMANT_ERROR("Predicate does not have type Bool");
   }
   type = Object;
+  return NULL;
 }
 
-void branch_class::semant()
+void branch_class::enter_scope(SemantContextP ctx)
 {
-  SymbolTable<Symbol, Symbol> *object_table = curr_class->get_object_table();
-  object_table->enterscope();
-  curr_classtable->check_and_add_to_object_table(name, type_decl);
-  expr->semant();
-  object_table->exitscope();
+  ctx->enterscope();
+  ctx->check_and_add_to_object_table(name, type_decl);
 }
 
-void block_class::semant()
+void branch_class::exit_scope(SemantContextP ctx)
 {
-  for(int i = body->first(); body->more(i); i = body->next(i)) {
-    body->nth(i)->semant();
-    type = body->nth(i)->get_type();
-  }
+  ctx->exitscope();
 }
 
-void let_class::semant()
+Expression block_class::semant_step(SemantContextP ctx, int &state)
 {
-  SymbolTable<Symbol, Symbol> *object_table = curr_class->get_object_table();
+  if (state > 0) {
+    type = body_list[state - 1]->get_type();
+  }
+  if (state < (int) body_list.size()) {
+    return body_list[state++];
+  }
+  return NULL;
+}
 
-  init->semant();
-  object_table->enterscope();
-  curr_classtable->check_and_add_to_object_table(identifier, type_decl);
-  body->semant();
-  if (curr_classtable->leq(init->get_type(), type_decl)) {
+Expression let_class::semant_step(SemantContextP ctx, int &state)
+{
+  switch (state++) {
+  case 0:
+    return init;
+  case 1:
+    ctx->enterscope();
+    ctx->check_and_add_to_object_table(identifier, type_decl);
+    return body;
+  }
+  if (ctx->leq(init->get_type(), type_decl)) {
     type = body->get_type();
   } else {
     SEMANT_ERROR("Expression with type " << init->get_type() << " does not inherit from " << type_decl);
   }
-  object_table->exitscope();
+  ctx->exitscope();
+  return NULL;
 }
 
-void plus_class::semant()
+Expression plus_class::semant_step(SemantContextP ctx, int &state)
 {
-  e1->semant();
-  e2->semant();
+  switch (state++) {
+  case 0:
+    return e1;
+  case 1:
+    return e2;
+  }
   if (e1->get_type() != Int || e2->get_type() != Int) {
     SEMANT_ERROR("One of the expressions for multiply does not evaluate to Integer");
   } else {
     type = Int;
   }
+  return NULL;
 }
 
-void sub_class::semant()
+Expression sub_class::semant_step(SemantContextP ctx, int &state)
 {
-  e1->semant();
-  e2->semant();
+  switch (state++) {
+  case 0:
+    return e1;
+  case 1:
+    return e2;
+  }
   if (e1->get_type() !=Int || e2->get_type() != Int) {
     SEMANT_ERROR("One of the expressions for multiply does not evaluate to Integer");
   } else {
     type = Int;
   }
 
+  return NULL;
 }
 
-void eq_class::semant()
+Expression eq_class::semant_step(SemantContextP ctx, int &state)
 {
-    e1->semant();
-    e2->semant();
+    switch (state++) {
+    case 0:
+      return e1;
+    case 1:
+      return e2;
+    }
     if ((e1->get_type() == Int || e1->get_type() == Bool || e1->get_type() == Str ||
 	e2->get_type() ==Int || e2->get_type() == Bool || e2->get_type() == Str)
 	&& e1->get_type() != e2->get_type()) {
@@ -846,118 +1742,397 @@ void eq_class::semant()
     } else {
       type = Bool;
     }
+    return NULL;
 }
 
-void mul_class::semant()
+Expression mul_class::semant_step(SemantContextP ctx, int &state)
 {
-  e1->semant();
-  e2->semant();
+  switch (state++) {
+  case 0:
+    return e1;
+  case 1:
+    return e2;
+  }
   if (e1->get_type() !=Int || e2->get_type() != Int) {
     SEMANT_ERROR("One of the expressions for multiply does not evaluate to Integer");
   } else {
     type = Int;
   }
+  return NULL;
 }
 
-void divide_class::semant()
+Expression divide_class::semant_step(SemantContextP ctx, int &state)
 {
-  e1->semant();
-  e2->semant();
+  switch (state++) {
+  case 0:
+    return e1;
+  case 1:
+    return e2;
+  }
   if (e1->get_type() !=Int || e2->get_type() != Int) {
     SEMANT_ERROR("One of the expressions for divide does not evaluate to Integer");
   } else {
     type = Int;
   }
 
+  return NULL;
 }
 
-void neg_class::semant()
+Expression neg_class::semant_step(SemantContextP ctx, int &state)
 {
-  e1->semant();
+  if (state++ == 0) {
+    return e1;
+  }
   if (e1->get_type() == Int) {
     type = Int;
   } else {
     SEMANT_ERROR("Expression does not have Integer type");
   }
+  return NULL;
 }
 
-void lt_class::semant()
+Expression lt_class::semant_step(SemantContextP ctx, int &state)
 {
-  e1->semant();
-  e2->semant();
+  switch (state++) {
+  case 0:
+    return e1;
+  case 1:
+    return e2;
+  }
   if (e1->get_type() !=Int || e2->get_type() != Int) {
     SEMANT_ERROR("One of the expressions for lt does not evaluate to Integer");
   } else {
     type = Bool;
   }
+  return NULL;
 }
 
 
-void leq_class::semant()
+Expression leq_class::semant_step(SemantContextP ctx, int &state)
 {
-  e1->semant();
-  e2->semant();
+  switch (state++) {
+  case 0:
+    return e1;
+  case 1:
+    return e2;
+  }
   if (e1->get_type() != Int || e2->get_type() != Int) {
     SEMANT_ERROR("One of the expressions for leq does not evaluate to Integer");
   } else {
     type = Bool;
   }
+  return NULL;
 }
 
-void comp_class::semant()
+Expression comp_class::semant_step(SemantContextP ctx, int &state)
 {
-  e1->semant();
+  if (state++ == 0) {
+    return e1;
+  }
   if (e1->get_type() == Bool) {
     type = Bool;
   } else {
     SEMANT_ERROR("Expression does not have type Bool");
   }
+  return NULL;
 }
 
-void int_const_class::semant()
+Expression int_const_class::semant_step(SemantContextP ctx, int &state)
 {
   type = Int;
+  return NULL;
 }
 
-void bool_const_class::semant()
+Expression bool_const_class::semant_step(SemantContextP ctx, int &state)
 {
   type = Bool;
+  return NULL;
 }
 
-void string_const_class::semant()
+Expression string_const_class::semant_step(SemantContextP ctx, int &state)
 {
   type = Str;
+  return NULL;
 }
 
-void new__class::semant()
+Expression new__class::semant_step(SemantContextP ctx, int &state)
 {
-  curr_classtable->lookup_class(type_name);
+  ctx->lookup_class(type_name);
   type = type_name;
+  return NULL;
 }
 
-void isvoid_class::semant()
+Expression isvoid_class::semant_step(SemantContextP ctx, int &state)
 {
-  e1->semant();
+  if (state++ == 0) {
+    return e1;
+  }
   type = Bool;
+  return NULL;
 }
 
-void no_expr_class::semant()
+Expression no_expr_class::semant_step(SemantContextP ctx, int &state)
 {
   type = No_type;
+  return NULL;
 }
 
-void object_class::semant()
+Expression object_class::semant_step(SemantContextP ctx, int &state)
 {
   if (name == self) {
     type = SELF_TYPE;
   } else {
-    Symbol type_decl = curr_classtable->lookup_attr(curr_class->get_name(), name);
+    Symbol type_decl = ctx->lookup_attr(ctx->get_class()->get_name(), name);
     if (type_decl) {
       type = type_decl;
     } else {
       SEMANT_ERROR("Object " << name << " not declared in scope");
     }
   }
+  return NULL;
+}
+
+WorkStealingPool::WorkStealingPool(int workers) : workers(workers)
+{
+  queues = new std::vector<std::deque<int> >(workers);
+  locks = new std::vector<std::mutex>(workers);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+  delete queues;
+  delete locks;
+}
+
+/* Own work comes off the front (heaviest first), stolen work off the back */
+bool WorkStealingPool::take(int worker, int &task)
+{
+  for (int k = 0; k < workers; k++) {
+    int victim = (worker + k) % workers;
+    std::lock_guard<std::mutex> guard((*locks)[victim]);
+    std::deque<int> &queue = (*queues)[victim];
+    if (queue.empty()) {
+      continue;
+    }
+    if (k == 0) {
+      task = queue.front();
+      queue.pop_front();
+    } else {
+      task = queue.back();
+      queue.pop_back();
+    }
+    return true;
+  }
+  return false;
+}
+
+void WorkStealingPool::work(int worker, PoolTasks *tasks)
+{
+  int task;
+  while (take(worker, task)) {
+    tasks->run(worker, task);
+  }
+}
+
+void WorkStealingPool::run(PoolTasks *tasks, std::vector<int> &weights)
+{
+  std::vector<int> order(weights.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+		   [&weights](int a, int b) { return weights[a] > weights[b]; });
+
+  /* Longest processing time first: each task goes to the least loaded worker */
+  std::vector<long> load(workers, 0);
+  for (std::vector<int>::iterator it = order.begin(); it != order.end(); it++) {
+    int worker = std::min_element(load.begin(), load.end()) - load.begin();
+    (*queues)[worker].push_back(*it);
+    load[worker] += weights[*it];
+  }
+
+  std::vector<std::thread> threads;
+  for (int worker = 1; worker < workers; worker++) {
+    threads.push_back(std::thread(&WorkStealingPool::work, this, worker, tasks));
+  }
+  work(0, tasks);
+  for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++) {
+    it->join();
+  }
+}
+
+/*
+ * Checking one class body is one pool task, run in its worker's context.  A
+ * class that reports anything gets its diagnostics moved into a buffer of its
+ * own, allocated in the worker's arena, so they can be merged in class order.
+ */
+class ClassChecks : public PoolTasks {
+private:
+  std::vector<Class_> *classes;
+  std::vector<SemantContextP> &contexts;
+  std::vector<std::vector<SemantDiagnostic> *> &buffers;
+
+public:
+  ClassChecks(std::vector<Class_> *classes, std::vector<SemantContextP> &contexts,
+	      std::vector<std::vector<SemantDiagnostic> *> &buffers) :
+    classes(classes), contexts(contexts), buffers(buffers) { }
+  void run(int worker, int task);
+};
+
+void ClassChecks::run(int worker, int task)
+{
+  SemantContextP ctx = contexts[worker];
+  ctx->set_class((*classes)[task]);
+  (*classes)[task]->semant(ctx);
+  if (!ctx->get_diagnostics()->empty()) {
+    buffers[task] = ctx->get_arena()->make<std::vector<SemantDiagnostic> >();
+    ctx->take_diagnostics(buffers[task]);
+  }
+}
+
+/*
+ * Each worker checks its classes in a context and arena of its own, so
+ * workers never allocate from a shared one.  The expression pass only
+ * touches the class's own object table and reads the shared class table, so
+ * classes are independent; the diagnostics are merged in class order so the
+ * output matches a serial run, and the worker arenas are freed afterwards.
+ */
+static void check_classes_parallel(ClassTableP classtable, SemantContextP ctx, std::vector<Class_> *classes)
+{
+  std::vector<int> weights;
+  for (std::vector<Class_>::iterator it = classes->begin(); it != classes->end(); it++) {
+    weights.push_back((*it)->get_weight());
+  }
+
+  int workers = std::max(1, std::min(semant_jobs, (int) classes->size()));
+  std::vector<SemantContextP> contexts;
+  for (int worker = 0; worker < workers; worker++) {
+    Arena *arena = new Arena();
+    contexts.push_back(arena->make<SemantContext>(classtable, arena));
+  }
+  std::vector<std::vector<SemantDiagnostic> *> buffers(classes->size(), NULL);
+
+  ClassChecks checks(classes, contexts, buffers);
+  WorkStealingPool pool(workers);
+  pool.run(&checks, weights);
+
+  for (std::vector<std::vector<SemantDiagnostic> *>::iterator it = buffers.begin(); it != buffers.end(); it++) {
+    if (*it != NULL) {
+      ctx->append_diagnostics(*it);
+    }
+  }
+  for (std::vector<SemantContextP>::iterator it = contexts.begin(); it != contexts.end(); it++) {
+    ctx->merge(*it);
+    delete (*it)->get_arena();
+  }
+}
+
+SemantResult::SemantResult(Program program, SemantContextP ctx) :
+  errors(ctx->errors()), program(program)
+{
+  diagnostics = new std::vector<SemantDiagnostic>(*ctx->get_diagnostics());
+  phase_times = new std::vector<SemantPhaseTime>(*ctx->get_phase_times());
+  counters = ctx->get_counters();
+}
+
+SemantResult::~SemantResult()
+{
+  delete diagnostics;
+  delete phase_times;
+}
+
+void SemantResult::print(ostream& stream)
+{
+  for (std::vector<SemantDiagnostic>::iterator it = diagnostics->begin(); it != diagnostics->end(); it++) {
+    if (it->filename != NULL) {
+      stream << it->filename << ":" << it->line << ": ";
+    }
+    if (it->warning) {
+      stream << "warning: ";
+    }
+    stream << it->message << endl;
+  }
+}
+
+/* The passes check() runs, in order; the first to fail ends the analysis */
+static const char *semant_phases[] = {
+  "install_classes", "get_environment", "generate_tree", "check_cycle",
+  "number_tree", "build_dispatch_tables", "build_attr_layouts", "check_main",
+  "check_methods", "check_attrs", "check_parents", "semant"
+};
+
+#define SEMANT_PHASES ((int) (sizeof(semant_phases) / sizeof(semant_phases[0])))
+
+static int run_phase(int phase, ClassTableP classtable, SemantContextP ctx, std::vector<Class_> *classes)
+{
+  switch (phase) {
+  case 0:  return classtable->install_classes(ctx, classes);
+  case 1:  return classtable->get_environment(ctx);
+  case 2:  return classtable->generate_tree(ctx);
+  case 3:  return classtable->check_cycle(ctx);
+  case 4:  return classtable->number_tree();
+  case 5:  return classtable->build_dispatch_tables();
+  case 6:  return classtable->build_attr_layouts();
+  case 7:  return classtable->check_main(ctx);
+  case 8:  return classtable->check_methods(ctx);
+  case 9:  return classtable->check_attrs(ctx);
+  case 10: return classtable->check_parents(ctx);
+  }
+  if (semant_jobs > 1) {
+    check_classes_parallel(classtable, ctx, classes);
+  } else {
+    for (std::vector<Class_>::iterator it = classes->begin(); it != classes->end(); it++) {
+      (*it)->semant(ctx);
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+/* One JSON object with the time of every pass that ran and the counters */
+void SemantResult::print_stats(ostream& stream)
+{
+  stream << "{\"errors\": " << errors << ", \"phases\": {";
+  for (std::vector<SemantPhaseTime>::iterator it = phase_times->begin(); it != phase_times->end(); it++) {
+    stream << (it == phase_times->begin() ? "" : ", ") << "\"" << it->phase << "\": " << it->seconds;
+  }
+  stream << "}, \"counters\": {"
+	 << "\"leq\": " << counters.leq
+	 << ", \"lub\": " << counters.lub
+	 << ", \"lookup_class\": " << counters.lookup_class
+	 << ", \"get_method\": " << counters.get_method
+	 << ", \"get_attr\": " << counters.get_attr
+	 << ", \"scopes\": " << counters.scopes
+	 << ", \"released_bytes\": " << counters.released_bytes << "}}" << endl;
+}
+
+/*
+ * Library entry point: checks the program and returns what was found.
+ * Nothing is printed and the process is never terminated, so it can be
+ * called repeatedly from a long-lived process.
+ */
+SemantResult *program_class::check()
+{
+    std::call_once(constants_initialized, initialize_constants);
+
+    /* ClassTable constructor may do some semantic analysis */
+    Arena *arena = new Arena();
+    ClassTable *classtable = arena->make<ClassTable>(arena);
+    SemantContext *ctx = arena->make<SemantContext>(classtable, arena);
+
+    for (int phase = 0; phase < SEMANT_PHASES; phase++) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      int status = run_phase(phase, classtable, ctx, &class_list);
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      ctx->record_phase(semant_phases[phase], elapsed.count());
+      if (status == EXIT_FAILURE) {
+	break;
+      }
+    }
+
+    SemantResult *result = new SemantResult(this, ctx);
+    classtable->release_tables();
+    delete arena;
+    return result;
 }
 
 /*   This is the entry point to the semantic checker.
@@ -975,28 +2150,14 @@ void object_class::semant()
  */
 void program_class::semant()
 {
-    initialize_constants();
-
-    /* ClassTable constructor may do some semantic analysis */
-    curr_classtable = new ClassTable();
-
-    if (curr_classtable->install_classes(classes) == EXIT_FAILURE ||
-	curr_classtable->get_environment() == EXIT_FAILURE ||
-	curr_classtable->generate_tree() == EXIT_FAILURE ||
-	curr_classtable->check_cycle() == EXIT_FAILURE ||
-	curr_classtable->check_main() == EXIT_FAILURE ||
-	curr_classtable->check_methods() == EXIT_FAILURE ||
-	curr_classtable->check_attrs() == EXIT_FAILURE ||
-	curr_classtable->check_parents() == EXIT_FAILURE) {
-      goto error;
-    }
-
-    for(int i = classes->first(); classes->more(i); i = classes->next(i)) {
-      classes->nth(i)->semant();
+    SemantResult *result = check();
+    result->print(cerr);
+    if (semant_stats) {
+      result->print_stats(cerr);
     }
- 
-error:
-    if (curr_classtable->errors()) {
+    int errors = result->get_errors();
+    delete result;
+    if (errors) {
 	cerr << "Compilation halted due to static semantic errors." << endl;
 	exit(EXIT_FAILURE);
     }
@@ -3,6 +3,13 @@
 
 #include <assert.h>
 #include <iostream>  
+#include <deque>
+#include <mutex>
+#include <new>
+#include <scoped_allocator>
+#include <sstream>
+#include <string>
+#include <type_traits>
 #include "cool-tree.h"
 #include "stringtab.h"
 #include "symtab.h"
@@ -11,9 +18,190 @@
 #define TRUE 1
 #define FALSE 0
 
+// Every object starts with the class tag, the object size and the dispatch
+// table pointer; attributes follow in layout slot order.
+#define OBJECT_HEADER_WORDS 3
+
+// Number of worker threads used to type-check class bodies (-j N).
+extern int semant_jobs;
+
+// Count hot operations and print per-pass statistics as JSON.
+extern int semant_stats;
+
+// Free each class's scratch tables as soon as its bodies are checked.
+extern int semant_low_memory;
+
+// Step expressions through a switch on their kind, not a virtual call.
+extern int semant_tagged;
+
+// Also report warnings, such as case branches that can never be selected.
+extern int semant_warnings;
+
+// The basic classes always take ids 0 .. BASIC_CLASSES - 1, Object first.
+#define BASIC_CLASSES 5
+
+// Size of the blocks the arena carves allocations out of.
+#define ARENA_BLOCK_SIZE 65536
+
 class ClassTable;
 typedef ClassTable *ClassTableP;
 
+// Bump allocator owning everything one analysis allocates.  Objects with
+// non-trivial destructors are recorded and destroyed in reverse order when
+// the arena is deleted, which then frees all of its blocks at once.
+
+class Arena {
+private:
+  struct Finalizer {
+    void (*destroy)(void *object);
+    void *object;
+  };
+  std::vector<char *> *blocks;
+  std::vector<Finalizer> *finalizers;
+  char *next;
+  char *limit;
+  template <class T> static void destroy(void *object) {
+    static_cast<T *>(object)->~T();
+  }
+  Arena(const Arena &);
+  Arena &operator=(const Arena &);
+
+public:
+  Arena();
+  ~Arena();
+  void *allocate(size_t size, size_t align);
+  template <class T, class... Args> T *make(Args&&... args) {
+    T *object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      Finalizer finalizer = { &Arena::destroy<T>, object };
+      finalizers->push_back(finalizer);
+    }
+    return object;
+  }
+};
+
+// Lets a std container take its memory from an arena, which gives it all
+// back at once, so deallocating does nothing.  Without an arena the
+// container uses the heap, for tables that low-memory mode frees early.
+
+template <class T> class ArenaAllocator {
+public:
+  typedef T value_type;
+  Arena *arena;
+  ArenaAllocator(Arena *arena) : arena(arena) { }
+  template <class U> ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) { }
+  T *allocate(size_t n) {
+    if (arena == NULL) {
+      return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *object, size_t n) {
+    if (arena == NULL) {
+      ::operator delete(object);
+    }
+  }
+};
+
+template <class T, class U> bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+{
+  return a.arena == b.arena;
+}
+
+template <class T, class U> bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+{
+  return a.arena != b.arena;
+}
+
+template <class T> using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+// Hash map whose nodes, and any arena containers it holds, share its arena.
+template <class K, class V> using ArenaHashMap =
+  std::unordered_map<K, V, std::hash<K>, std::equal_to<K>,
+		     std::scoped_allocator_adaptor<ArenaAllocator<std::pair<const K, V> > > >;
+
+// Scoped map from variable names to their declared types.  Bindings are
+// kept in one vector that doubles as the undo log: head maps a name to its
+// innermost binding, each binding remembers the one it shadows, and leaving
+// a scope pops its bindings and restores whatever they shadowed.
+
+class ScopedEnv {
+private:
+  struct Binding {
+    Symbol name;
+    Symbol type;
+    int shadowed;
+  };
+  ArenaVector<Binding> bindings;
+  ArenaVector<int> marks;
+  ArenaHashMap<Symbol, int> head;
+
+public:
+  ScopedEnv(Arena *arena) : bindings(arena), marks(arena), head(arena) { }
+  void enterscope() { marks.push_back(bindings.size()); }
+  void exitscope();
+  void addid(Symbol name, Symbol type);
+  Symbol lookup(Symbol name);
+  bool probe(Symbol name);
+  size_t release();
+};
+
+// The part of a method's type an override has to repeat: its formal types
+// and its return type.  Signatures are hash-consed per analysis, in its
+// arena, on top of the basic classes' signatures, which every analysis
+// shares; methods with equal signatures share one object, so comparing two
+// signatures is a pointer compare while the analysis lasts.
+
+typedef ArenaHashMap<unsigned long long, ArenaVector<MethodSignature *> > SignatureTable;
+
+class MethodSignature {
+private:
+  ArenaVector<Symbol> types;
+  unsigned long long fingerprint;
+  MethodSignature(std::vector<Symbol> &types, unsigned long long fingerprint, Arena *arena) :
+    types(types.begin(), types.end(), arena), fingerprint(fingerprint) { }
+  static MethodSignature *find(SignatureTable *table, unsigned long long fingerprint, std::vector<Symbol> &types);
+  friend class Arena;
+
+public:
+  static MethodSignature *intern(SemantContextP ctx, Feature method);
+  unsigned long long get_fingerprint() { return fingerprint; }
+  int get_arg_len() { return types.size() - 1; }
+  Symbol get_arg_type(int i) { return types[i]; }
+  Symbol get_return_type() { return types.back(); }
+};
+
+// One class's own definition of a method or attribute name: the feature,
+// its slot, and the index of the nearest ancestor's definition of the same
+// name in the name's list, or -1.
+
+struct FeatureSlot {
+  int class_id;
+  Feature feature;
+  int slot;
+  int enclosing;
+};
+
+// Every class's definitions of each name, in preorder.
+
+typedef ArenaHashMap<Symbol, ArenaVector<FeatureSlot> > SlotTable;
+
+// Open-addressing hash from class name to dense class id.
+
+class ClassIndex {
+private:
+  Arena *arena;
+  ArenaVector<Symbol> *keys;
+  ArenaVector<int> *ids;
+  int count;
+  void grow();
+
+public:
+  ClassIndex(Arena *arena);
+  int find(Symbol name);
+  void insert(Symbol name, int id);
+};
+
 // This is a structure that may be used to contain the semantic
 // information such as the inheritance graph.  You may use it or not as
 // you like: it is only here to provide a container for the supplied
@@ -21,34 +209,210 @@ typedef ClassTable *ClassTableP;
 
 class ClassTable {
 private:
-  std::map<Symbol, Class_> *class_table;
-  int semant_errors;
+  Arena *arena;
+  ArenaVector<Class_> *class_table;
+  int shared_classes;
+  ClassIndex *class_index;
+  int object_id;
+  ArenaVector<int> *parent_ids;
+  ArenaVector<int> *child_start;
+  ArenaVector<int> *child_list;
+  ArenaVector<int> *pre;
+  ArenaVector<int> *post;
+  ArenaVector<int> *depth;
+  ArenaVector<int> *ancestors;
+  int ancestor_levels;
+  ArenaVector<int> *preorder;
+  SlotTable *method_slots;
+  ArenaVector<int> *dispatch_sizes;
+  SlotTable *attr_slots;
+  ArenaVector<int> *attr_counts;
+  static void build_prelude();
+  void build_basic_classes(SemantContextP ctx);
   void install_basic_classes();
-  ostream& error_stream;
+  void number_tree_from(int root);
+  int ancestor(int id, int k) { return (*ancestors)[id * ancestor_levels + k]; }
+  int find_slot(ArenaVector<FeatureSlot> &slots, int id);
+
+public:
+  ClassTable(Arena *arena);
+  int compare_methods(Feature method1, Feature method2);
+  int check_methods(SemantContextP ctx);
+  int check_attrs(SemantContextP ctx);
+  int check_parents(SemantContextP ctx);
+  int find_id(Symbol class_name) { return class_index->find(class_name); }
+  Class_ get_class(int id) { return (*class_table)[id]; }
+  int get_object_id() { return object_id; }
+  int get_pre(int id) { return (*pre)[id]; }
+  int get_depth(int id) { return (*depth)[id]; }
+  /* Every parent precedes its children; valid once check_cycle succeeds */
+  ArenaVector<int> *get_topological_order() { return preorder; }
+  bool is_subclass(int id1, int id2) {
+    return (*pre)[id2] <= (*pre)[id1] && (*post)[id1] <= (*post)[id2];
+  }
+  int lca(int id1, int id2);
+  int install_classes(SemantContextP ctx, std::vector<Class_> *classes);
+  int install_class(SemantContextP ctx, Symbol name, Class_ class_);
+  int generate_tree(SemantContextP ctx);
+  int get_environment(SemantContextP ctx);
+  int check_cycle(SemantContextP ctx);
+  int number_tree();
+  int build_dispatch_tables();
+  Feature get_method(int id, Symbol method_name);
+  int get_method_slot(int id, Symbol method_name);
+  int get_dispatch_size(int id) { return (*dispatch_sizes)[id]; }
+  int build_attr_layouts();
+  Feature get_attr(int id, Symbol attr_name);
+  int get_attr_slot(int id, Symbol attr_name);
+  int object_size(Symbol class_name);
+  int attr_offset(Symbol class_name, Symbol attr_name);
+  int check_main(SemantContextP ctx);
+  void release_tables();
+};
+
+// One reported problem: where it was found and the text after the location.
+// Diagnostics raised outside any class have no filename and line 0.
+// Warnings are reported alongside errors but do not count as errors.
+
+struct SemantDiagnostic {
+  Symbol filename;
+  int line;
+  std::string message;
+  bool warning;
+};
+
+// Wall-clock time spent in one pass of an analysis.
+
+struct SemantPhaseTime {
+  const char *phase;
+  double seconds;
+};
+
+// How often the checker's hot queries ran; only counted with semant_stats.
+// released_bytes is what semant_low_memory freed before the analysis ended.
+
+struct SemantCounters {
+  long leq;
+  long lub;
+  long lookup_class;
+  long get_method;
+  long get_attr;
+  long scopes;
+  long released_bytes;
+};
+
+// An expression whose check is under way and how far its semant_step got.
+
+struct SemantFrame {
+  Expression expr;
+  int state;
+};
+
+// The state of one analysis: the class table it checks against, the class
+// whose features are being checked, the diagnostics reported so far and the
+// arena its scratch data lives in.  All the checker entry points take it
+// explicitly, so independent analyses can run side by side.
+
+class SemantContext {
+private:
+  ClassTableP classtable;
+  Class_ curr_class;
+  int semant_errors;
+  std::vector<SemantDiagnostic> *diagnostics;
+  std::ostringstream *message;
+  ArenaVector<SemantFrame> *frames;
+  std::vector<SemantPhaseTime> *phase_times;
+  SemantCounters counters;
+  SignatureTable *signatures;
+  Arena *arena;
+  void finish_diagnostic();
+  template <bool tagged> void check_frames(Expression root);
 
 public:
-  ClassTable();
+  SemantContext(ClassTableP classtable, Arena *arena);
+  ClassTableP get_classtable() { return classtable; }
+  Arena *get_arena() { return arena; }
+  Class_ get_class() { return curr_class; }
+  void set_class(Class_ class_) { curr_class = class_; }
   int errors() { return semant_errors; }
+  std::vector<SemantDiagnostic> *get_diagnostics();
+  void merge(SemantContextP other);
+  void take_diagnostics(std::vector<SemantDiagnostic> *into);
+  void append_diagnostics(std::vector<SemantDiagnostic> *others);
+  void check_expression(Expression root);
+  std::vector<SemantPhaseTime> *get_phase_times() { return phase_times; }
+  void record_phase(const char *phase, double seconds);
+  SemantCounters &get_counters() { return counters; }
+  SignatureTable *get_signatures() { return signatures; }
+  void enterscope();
+  void exitscope();
   ostream& semant_error();
   ostream& semant_error(Class_ c);
   ostream& semant_error(Symbol filename, tree_node *t);
-  int compare_methods(Feature method1, Feature method2);
-  int check_methods();
-  int check_attrs();
-  int check_parents();
+  ostream& semant_warning(Symbol filename, tree_node *t);
   void check_and_add_to_object_table(Symbol name, Symbol type_decl);
   int add_to_object_table(Symbol name, Symbol type_decl);
   bool leq(Symbol class1, Symbol class2);
   Symbol lub(Symbol class1, Symbol class2);
+  Symbol lub(std::vector<Symbol> &types);
+  int lookup_id(Symbol class_name);
   Class_ lookup_class(Symbol class_name);
   Symbol lookup_attr(Symbol class_name, Symbol var_name);
   Feature lookup_method(Symbol class_name, Symbol method_name);
-  int install_classes(Classes classes);
-  int install_class(Symbol name, Class_ class_);
-  int generate_tree();
-  int get_environment();
-  int check_cycle();
-  int check_main();
+};
+
+// What a library-mode analysis hands back: the error count, the diagnostics
+// in report order, the time taken by each pass that ran, the operation
+// counts and the program, whose expressions carry their types.
+// Owned by the caller; checking never prints or exits.
+
+class SemantResult {
+private:
+  int errors;
+  std::vector<SemantDiagnostic> *diagnostics;
+  std::vector<SemantPhaseTime> *phase_times;
+  SemantCounters counters;
+  Program program;
+
+public:
+  SemantResult(Program program, SemantContextP ctx);
+  ~SemantResult();
+  int get_errors() { return errors; }
+  std::vector<SemantDiagnostic> *get_diagnostics() { return diagnostics; }
+  std::vector<SemantPhaseTime> *get_phase_times() { return phase_times; }
+  SemantCounters &get_counters() { return counters; }
+  Program get_program() { return program; }
+  void print(ostream& stream);
+  void print_stats(ostream& stream);
+};
+
+// Independent units of work numbered 0 .. n - 1, such as the classes of
+// one program or the programs of a batch.  Each task is told which worker
+// runs it, so tasks can keep per-worker state.
+
+class PoolTasks {
+public:
+  virtual ~PoolTasks() { }
+  virtual void run(int worker, int task) = 0;
+};
+
+// Runs a set of tasks on a fixed number of workers.  Tasks are dealt out
+// heaviest first to the least loaded worker's deque; a worker takes from the
+// front of its own deque and, once it runs dry, steals from the back of the
+// others.
+
+class WorkStealingPool {
+private:
+  int workers;
+  std::vector<std::deque<int> > *queues;
+  std::vector<std::mutex> *locks;
+  bool take(int worker, int &task);
+  void work(int worker, PoolTasks *tasks);
+
+public:
+  WorkStealingPool(int workers);
+  ~WorkStealingPool();
+  void run(PoolTasks *tasks, std::vector<int> &weights);
 };
 
 #endif